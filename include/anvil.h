@@ -11,28 +11,72 @@
 #include <dirent.h>
 #include <errno.h>
 #include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #define MAX_LINE 512
 #define MAX_SOURCES 256
 #define MAX_FLAGS 32
 #define MAX_INCLUDES 16
-#define MAX_WATCH_FILES 512
+#define MAX_CHANGED_FILES 256
+#define DEFAULT_WATCH_DEBOUNCE_MS 100
+#define DEFAULT_RUN_STOP_TIMEOUT_MS 3000
+#define MAX_TARGETS 16
+#define MAX_OBJECTS (MAX_TARGETS * MAX_SOURCES)
+#define MAX_UNITY_EXCLUDED 64
+#define MAX_VARIANTS 8
+#define MAX_WORKER_HOSTS 16
+#define MAX_REMOTE_SLOTS 64
+#define DEFAULT_WORKER_PORT 7878
+#define REMOTE_REFUSED -3        /* remote_compile: the worker turned the unit down */
+
+/* optimize = lto and/or pgo */
+#define OPTIMIZE_LTO 1
+#define OPTIMIZE_PGO 2
+
+typedef enum {
+    TARGET_EXECUTABLE,
+    TARGET_STATIC_LIBRARY,
+    TARGET_SHARED_LIBRARY
+} TargetKind;
+
+typedef enum {
+    PGO_USE,                /* build against the profile in build/pgo (if any) */
+    PGO_GENERATE            /* instrumented build that writes the profile */
+} PgoStage;
 
 typedef struct {
     char name[128];
+    TargetKind kind;
     char sources[MAX_SOURCES][128];
     int source_count;
+    char cflags[MAX_FLAGS][128];
+    int cflag_count;
     char ldflags[MAX_FLAGS][128];
     int ldflag_count;
+    char links[MAX_TARGETS][128];
+    int link_count;
+    char pch[128];          /* overrides the global pch; "none" disables it */
+    int no_unity;           /* keep this target out of unity batches */
 } Target;
 
+/* [variant:name] block: flags overlaid on the base config, built in build/<name> */
+typedef struct {
+    char name[64];
+    char cflags[MAX_FLAGS][128];
+    int cflag_count;
+    char ldflags[MAX_FLAGS][128];
+    int ldflag_count;
+    int optimize;           /* OPTIMIZE_* bits, -1 = inherit */
+} Variant;
+
 typedef struct {
     char project_name[128];
     char version[64];  
     char target_name[128];  
     char sources[MAX_SOURCES][128];  
     int source_count;  
-    Target targets[16];  
+    Target targets[MAX_TARGETS];
     int target_count;
     char includes[MAX_INCLUDES][128];
     int include_count;
@@ -40,18 +84,165 @@ typedef struct {
     int cflag_count;
     char ldflags[MAX_FLAGS][128];  
     int ldflag_count;  
+    char links[MAX_TARGETS][128];
+    int link_count;
+    char pch[128];          /* header precompiled once per flag set and force-included */
     char output_dir[128];
+    char generator[16];     /* build file backend: make (default) or ninja */
+    int cache_enabled;      /* share objects through the local object cache */
+    char cache_dir[256];    /* defaults to $XDG_CACHE_HOME/anvil or ~/.cache/anvil */
+    int64_t cache_size;     /* LRU size cap in bytes, 0 = default */
+    int jobs;               /* parallel jobs for the built-in executor, 0 = one per core */
+    int use_executor;       /* build with the built-in executor instead of make */
+    int cli_jobs;           /* -j and -G, which win over build.conf on every reload */
+    char cli_generator[16];
+    int unity;              /* compile C sources in generated unity batches */
+    int unity_batch;        /* sources per batch, 0 = default */
+    char unity_excluded[MAX_UNITY_EXCLUDED][128];  /* pulled out of their batch by watch mode */
+    int unity_excluded_count;
+    int optimize;           /* OPTIMIZE_* bits */
+    char train_cmd[MAX_LINE];  /* PGO training workload, run from the project root */
+    PgoStage pgo_stage;     /* which PGO flags the next build uses */
+    char linker[16];        /* -fuse-ld name after probing, "" for gcc's default */
+    int linker_probed;      /* linker = auto picked it */
+    int debug_split;        /* -gsplit-dwarf and compressed debug sections */
+    char workers[MAX_LINE]; /* remote compile workers, [ssh:]host[:port][/slots] */
+    char watch_backend[16]; /* auto (default), inotify or poll */
+    int watch_debounce_ms;  /* quiet time that ends a burst of changes, 0 = rebuild at once */
+    int run_stop_timeout_ms;  /* time between SIGTERM and SIGKILL when stopping a program or a stale build */
+    Variant variants[MAX_VARIANTS];
+    int variant_count;
+    char default_variants[MAX_LINE];  /* built when no --variant is given */
+    char variant[64];       /* the variant applied to this config, "" for none */
+    char build_dir[128];    /* relative to the project root: build or build/<variant> */
+    char source_root[32];   /* the project root relative to build_dir */
+    char config_file[256];  /* the build.conf this was parsed from */
 } BuildConfig;
 
+/* the files watch mode follows, see watch_set.c */
+typedef struct {
+    char *arena;            /* interned paths, NUL-terminated back to back */
+    size_t arena_used;
+    size_t arena_size;
+    size_t *path_at;        /* where each file's path starts in the arena */
+    int64_t *mtimes;        /* nanoseconds */
+    int64_t *sizes;         /* -1 once the file is gone */
+    ino_t *inodes;
+    int count;
+    int capacity;
+    int *index;             /* open addressing over files, 1-based, 0 = empty */
+    int index_size;
+} WatchSet;
+
+/* the files behind one watch-mode rebuild */
+typedef struct {
+    char paths[MAX_CHANGED_FILES][256];
+    int count;
+    int overflow;           /* more changed than fit; assume anything may have */
+    int reloaded;           /* build.conf was parsed again; every target is in scope */
+    int level;              /* the most work they call for (WATCH_* in watch_system.c) */
+} ChangeSet;
+
+/* directories watch mode follows, through inotify or by polling their mtimes */
+typedef struct {
+    int fd;                 /* inotify, -1 when polling */
+    int wake_fd;            /* also ends a wait when readable, -1 for none */
+    WatchSet dirs;          /* every directory followed; the polling fallback compares their stat data */
+    int *wd_slots;          /* inotify watch descriptor -> slot in dirs + 1, 0 for none */
+    int wd_capacity;
+} DirWatch;
+
 typedef struct {
     char path[256];
-    time_t mtime;
-} WatchFile;
+    uint64_t hash;          /* content hash */
+    uint64_t signature;     /* for build outputs: hash of the inputs it was built from */
+    int64_t size;
+    int64_t mtime;          /* nanoseconds */
+    int valid;
+} HashEntry;
+
+typedef struct {
+    char path[256];
+    HashEntry *entries;
+    int count;
+    int capacity;
+    int *index;             /* open addressing over entries, 1-based, 0 = empty */
+    int index_size;
+    pthread_mutex_t lock;
+} HashDB;
+
+typedef struct {
+    int enabled;
+    char dir[512];
+    char root[512];         /* checkout root, stripped from preprocessed sources */
+    int64_t max_size;
+    uint64_t compiler;      /* identity hash of the compiler */
+    int hits;
+    int misses;
+    int stores;
+    int evictions;
+} ObjectCache;
+
+/* one connection to an `anvil worker`, used by one executor thread */
+typedef struct {
+    int in;                 /* -1 while not connected */
+    int out;
+    pid_t pid;              /* the transport command for ssh: workers */
+    int host;
+    int cores;              /* reported by the worker on connect */
+    int dead;               /* failed once; its jobs compile locally */
+} RemoteConn;
+
+typedef struct {
+    char hosts[MAX_WORKER_HOSTS][128];
+    int host_count;
+    RemoteConn slots[MAX_REMOTE_SLOTS];
+    int slot_count;
+} RemotePool;
+
+/* a distinct set of per-target compile flags; objects are keyed by source + flag set */
+typedef struct {
+    char flags[MAX_LINE];
+    char pch[128];          /* precompiled header source, "" for none */
+    char name[16];
+    uint64_t hash;
+} FlagSet;
+
+typedef struct {
+    char source[128];
+    char object[192];
+    int flagset;
+} BuildObject;
+
+typedef struct {
+    FlagSet flagsets[MAX_TARGETS + 1];
+    int flagset_count;
+    BuildObject objects[MAX_OBJECTS];
+    int object_count;
+    int target_flagset[MAX_TARGETS];
+    int target_objects[MAX_TARGETS][MAX_SOURCES];
+    int target_object_count[MAX_TARGETS];
+    int target_links[MAX_TARGETS][MAX_TARGETS];  /* libraries in link order, dependents first */
+    int target_link_count[MAX_TARGETS];
+    char unity_sources[MAX_SOURCES][128];  /* scratch: one target's translation units in unity mode */
+} BuildGraph;
 
 
 int parse_buildfile(const char *filename, BuildConfig *cfg);
+void apply_command_line(BuildConfig *cfg);
+
+/* an entry found by walk_directory */
+typedef struct {
+    const char *path;       /* the walk root joined with the entry's relative path */
+    const char *name;
+    int is_dir;
+} DirEntry;
+
+/* returns 1 to descend into a directory, 0 to go on, -1 to stop the walk */
+typedef int (*DirWalkVisit)(const DirEntry *entry, void *ctx);
 
 /* file utils */ 
+int walk_directory(const char *root, int recursive, DirWalkVisit visit, void *ctx);
 int create_directory(const char *path);
 int create_directory_recursive(const char *path);
 int is_c_file(const char *filename);
@@ -59,21 +250,150 @@ int is_header_file(const char *filename);
 void expand_glob(const char *pattern, char dest[][128], int *count, int max);
 time_t get_mtime(const char *path);
 
-void generate_makefile(BuildConfig *cfg);
+int generate_makefile(BuildConfig *cfg, FILE *f);
+int generate_ninja(BuildConfig *cfg, FILE *f);
+
+/* generators */
+typedef struct {
+    const char *name;
+    const char *output;         /* build file it writes into the build directory */
+    const char *build_command;  /* full build, run from the project root; %s is the build directory */
+    const char *target_command; /* build one named target; %s is the build directory, then the target */
+    int (*generate)(BuildConfig *cfg, FILE *f);
+} Generator;
+
+const Generator *find_generator(const char *name);
+const Generator *config_generator(BuildConfig *cfg);
+int generate_build_files(BuildConfig *cfg);
+
+/* build graph */
+BuildGraph *build_graph_create(BuildConfig *cfg);
+void build_graph_free(BuildGraph *graph);
+int find_target(BuildConfig *cfg, const char *name);
+void target_output_name(const Target *target, char *out, size_t size);
+void target_output_path(BuildConfig *cfg, const Target *target, char *out, size_t size);
+void compile_flags(BuildConfig *cfg, BuildGraph *graph, int flagset, char *out, size_t size);
+void pch_path(BuildGraph *graph, int flagset, char *out, size_t size);
+void optimize_flags(BuildConfig *cfg, char *out, size_t size);
+
+/* build variants */
+int find_variant(BuildConfig *cfg, const char *name);
+int apply_variant(BuildConfig *cfg, const char *name);
+int select_variants(BuildConfig *cfg, const char *list, char names[][64], int max);
+
+/* unity builds */
+int unity_excluded(BuildConfig *cfg, const char *source);
+int unity_exclude(BuildConfig *cfg, const char *source);
+int unity_sources(BuildConfig *cfg, const Target *target, char out[][128], int max);
+
+/* linker selection and split debug info */
+int valid_linker(const char *name);
+void resolve_linker(BuildConfig *cfg);
+void report_linker(const BuildConfig *cfg);
+void debug_flags(BuildConfig *cfg, char *out, size_t size);
+void link_flags(BuildConfig *cfg, char *out, size_t size);
+
+/* distributed compilation */
+int remote_pool_init(RemotePool *pool, const char *list);
+void remote_pool_free(RemotePool *pool);
+int remote_connect(RemotePool *pool, int slot);
+void remote_disconnect(RemotePool *pool, int slot);
+void remote_pool_interrupt(RemotePool *pool);
+int remote_handshake(RemoteConn *conn, int *cores);
+int remote_flag_allowed(const char *flag);
+int remote_flags(const char *flags, char *out, size_t size);
+int remote_compile(RemoteConn *conn, const char *flags, const char *source, const char *object, char **output);
+int remote_serve(int in, int out);
+int run_worker(int argc, char *argv[]);
+
+/* build daemon */
+int daemon_mode(const char *config_file, int jobs, const char *generator, const char *variant);
+int daemon_client(int argc, char *argv[]);
+
+/* build executor */
+int default_job_count(void);
+int execute_build(BuildConfig *cfg, int jobs);
+int execute_targets(BuildConfig *cfg, int jobs, const int *selected);
+int execute_graph(BuildConfig *cfg, BuildGraph *graph, int jobs);
+int execute_graph_targets(BuildConfig *cfg, BuildGraph *graph, int jobs, const int *selected);
+void executor_cancel(void);
+void root_path(BuildConfig *cfg, const char *path, char *out, size_t size);
+int for_each_dependency(BuildConfig *cfg, const char *output, int (*visit)(const char *dep, void *ctx), void *ctx);
+
+/* profile-guided optimization */
+int pgo_build(BuildConfig *cfg, int jobs);
+
+/* include analysis */
+int analyze_includes(BuildConfig *cfg);
+
+/* build trace */
+#define TRACE_FILE "build/anvil_trace.json"
+void trace_enable(void);
+int trace_enabled(void);
+int64_t trace_now_us(void);
+void trace_span(const char *category, const char *name, int track, int64_t start_us);
+int trace_mark(void);
+int trace_write(const char *path);
+void trace_report_slowest(int mark, int count);
+
+/* content hash database */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed);
+int hash_file(const char *path, uint64_t *hash);
+int hash_db_load(HashDB *db, const char *path);
+int hash_db_save(HashDB *db);
+void hash_db_free(HashDB *db);
+int hash_db_file_hash(HashDB *db, const char *path, uint64_t *hash);
+int hash_db_cached_hash(HashDB *db, const char *path, uint64_t *hash);
+uint64_t hash_db_signature(HashDB *db, const char *path);
+void hash_db_set_signature(HashDB *db, const char *path, uint64_t signature);
+
+/* object cache */
+int64_t parse_size(const char *value);
+int object_cache_init(ObjectCache *cache, BuildConfig *cfg);
+int object_cache_key(ObjectCache *cache, const char *preprocessed, const char *cmd, uint64_t *key);
+int object_cache_fetch(ObjectCache *cache, uint64_t key, const char *dest);
+void object_cache_store(ObjectCache *cache, uint64_t key, const char *src);
+void object_cache_trim(ObjectCache *cache);
+void object_cache_report(ObjectCache *cache);
 
 /* string utils */
 void trim(char *str);
 void parse_list(char *value, char dest[][128], int *count, int max);
+uint64_t hash_string(const char *str);
 
 /* watch system */ 
-void add_watch_file(const char *path, WatchFile *watch_files, int *watch_count);
-void scan_directory_for_headers(const char *dir, WatchFile *watch_files, int *watch_count);
-void setup_watch_list(BuildConfig *cfg, WatchFile *watch_files, int *watch_count);
-int check_for_changes(WatchFile *watch_files, int watch_count);
+void add_watch_file(const char *path, WatchSet *set);
+void scan_directory_for_headers(const char *dir, WatchSet *set);
+void setup_watch_list(BuildConfig *cfg, WatchSet *set);
+int check_for_changes(WatchSet *set);
 void print_timestamp(void);
-int run_make(int run_after_build);
+int affected_targets(BuildConfig *cfg, const ChangeSet *changes, int *affected);
+int run_make(BuildConfig *cfg, int run_after_build, const ChangeSet *changes, ChangeSet *pending);
 void watch_mode(BuildConfig *cfg, int run_after_build);
 
+/* watched file table */
+int watch_set_add(WatchSet *set, const char *path);
+int watch_set_find(const WatchSet *set, const char *path);
+const char *watch_set_path(const WatchSet *set, int i);
+int watch_set_stat(WatchSet *set, int i);
+void watch_set_clear(WatchSet *set);
+void watch_set_free(WatchSet *set);
+
+/* inotify watch backend */
+int dir_watch_open(DirWatch *w, int use_inotify);
+int dir_watch_add(DirWatch *w, const char *dir);
+int dir_watch_wait(DirWatch *w, int timeout_ms, char paths[][256], int max);
+int dir_watch_poll(DirWatch *w, char paths[][256], int max);
+void dir_watch_close(DirWatch *w);
+
+/* watch & run supervisor */
+int supervisor_init(void);
+int supervisor_interrupted(void);
+void supervisor_reap(void);
+int64_t supervisor_stop(const char *name, pid_t pid, int timeout_ms);
+int supervisor_restart(BuildConfig *cfg, int target, int64_t since_us);
+void supervisor_stop_all(int timeout_ms);
+
 /* updater system */
 int update_to_latest(void);
 int update_to_version(const char *target_version);
@@ -0,0 +1,913 @@
+#define _GNU_SOURCE
+#include "anvil.h"
+#include "colors.h"
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+/*
+ * Built-in build executor: runs the compile and link graph straight from
+ * the parsed BuildConfig on a work-stealing pool of workers, without
+ * going through make. Commands run from the build directory exactly like
+ * the Makefile recipes, so objects and .d files are interchangeable
+ * between the two.
+ */
+
+#define MAX_JOBS (MAX_OBJECTS + MAX_TARGETS * 2 + 1)
+#define MAX_WORKERS 64
+
+typedef enum {
+    JOB_COMPILE,
+    JOB_PCH,
+    JOB_LINK
+} JobKind;
+
+typedef struct {
+    JobKind kind;
+    int index;                      /* object index for compiles, flag set for pchs, target index for links */
+    char output[256];               /* relative to the build directory */
+    int pending;                    /* dependencies not yet finished */
+    int skipped;                    /* not needed for the targets being built */
+    int rebuilt_input;              /* set when a dependency produced a new output */
+    int dependents[MAX_TARGETS];
+    int dependent_count;
+} Job;
+
+typedef struct {
+    int items[MAX_JOBS];
+    int top;                        /* thieves take from here */
+    int bottom;                     /* the owner pushes and pops here */
+    pthread_mutex_t lock;
+} JobDeque;
+
+typedef struct {
+    BuildConfig *cfg;
+    BuildGraph *graph;
+    Job jobs[MAX_JOBS];
+    int job_count;
+    JobDeque *deques;
+    int worker_count;
+    int local_workers;              /* threads past these each own a remote slot */
+    pid_t running[MAX_WORKERS + MAX_REMOTE_SLOTS];
+
+    HashDB hashes;
+    ObjectCache cache;
+    RemotePool remote;
+    int remote_compiles;
+
+    int remaining;
+    int queued;
+    int failed;
+    int executed;
+    int unchanged;                  /* stale by timestamp but skipped on content */
+    volatile sig_atomic_t cancelled;
+    pthread_mutex_t state_lock;
+    pthread_cond_t state_cond;
+    pthread_mutex_t output_lock;
+} Executor;
+
+typedef struct {
+    Executor *ex;
+    int id;
+} Worker;
+
+int default_job_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n < 1) return 1;
+    return n > MAX_WORKERS ? MAX_WORKERS : (int)n;
+}
+
+static void push_job(Executor *ex, int worker, int job) {
+    JobDeque *dq = &ex->deques[worker];
+    pthread_mutex_lock(&dq->lock);
+    dq->items[dq->bottom++ % MAX_JOBS] = job;
+    pthread_mutex_unlock(&dq->lock);
+
+    pthread_mutex_lock(&ex->state_lock);
+    ex->queued++;
+    pthread_cond_signal(&ex->state_cond);
+    pthread_mutex_unlock(&ex->state_lock);
+}
+
+static int pop_job(JobDeque *dq) {
+    int job = -1;
+    pthread_mutex_lock(&dq->lock);
+    if(dq->bottom > dq->top) job = dq->items[--dq->bottom % MAX_JOBS];
+    pthread_mutex_unlock(&dq->lock);
+    return job;
+}
+
+static int steal_job(JobDeque *dq) {
+    int job = -1;
+    pthread_mutex_lock(&dq->lock);
+    if(dq->bottom > dq->top) job = dq->items[dq->top++ % MAX_JOBS];
+    pthread_mutex_unlock(&dq->lock);
+    return job;
+}
+
+/* own deque first (LIFO keeps freshly unlocked links hot), then steal oldest work from the others */
+static int next_job(Executor *ex, int id) {
+    int job = pop_job(&ex->deques[id]);
+    for(int i = 1; job < 0 && i < ex->worker_count; i++) {
+        job = steal_job(&ex->deques[(id + i) % ex->worker_count]);
+    }
+    if(job >= 0) {
+        pthread_mutex_lock(&ex->state_lock);
+        ex->queued--;
+        pthread_mutex_unlock(&ex->state_lock);
+    }
+    return job;
+}
+
+static int file_mtime_ns(const char *path, int64_t *mtime) {
+    struct stat st;
+    if(stat(path, &st) != 0) return 0;
+    *mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    return 1;
+}
+
+/* commands and depfiles name paths relative to the build directory; the executor and the hash database work from the project root */
+void root_path(BuildConfig *cfg, const char *path, char *out, size_t size) {
+    size_t root_len = strlen(cfg->source_root);
+    if(path[0] == '/') {
+        snprintf(out, size, "%s", path);
+    } else if(strncmp(path, cfg->source_root, root_len) == 0 && path[root_len] == '/') {
+        snprintf(out, size, "%s", path + root_len + 1);
+    } else {
+        snprintf(out, size, "%s/%s", cfg->build_dir, path);
+    }
+}
+
+static int build_mtime_ns(BuildConfig *cfg, const char *path, int64_t *mtime) {
+    char full[512];
+    root_path(cfg, path, full, sizeof(full));
+    return file_mtime_ns(full, mtime);
+}
+
+/*
+ * Visit every prerequisite of an object's first .d rule ("obj.o: src dep \"
+ * continued over lines). Returns -1 when there is no depfile, 0 when the
+ * visitor stopped early, 1 otherwise.
+ */
+int for_each_dependency(BuildConfig *cfg, const char *output, int (*visit)(const char *dep, void *ctx), void *ctx) {
+    char depfile[512];
+    snprintf(depfile, sizeof(depfile), "%s/%s", cfg->build_dir, output);
+    char *dot = strrchr(depfile, '.');
+    if(dot) strcpy(dot, ".d");
+
+    FILE *f = fopen(depfile, "r");
+    if(!f) return -1;
+
+    int result = 1, seen_colon = 0;
+    char token[512];
+    while(fscanf(f, "%511s", token) == 1) {
+        size_t len = strlen(token);
+        if(!seen_colon) {
+            if(len && token[len - 1] == ':') seen_colon = 1;
+            continue;
+        }
+        if(strcmp(token, "\\") == 0) continue;
+        if(len && token[len - 1] == ':') break;  /* -MP phony rules start here */
+        if(!visit(token, ctx)) {
+            result = 0;
+            break;
+        }
+    }
+    fclose(f);
+    return result;
+}
+
+typedef struct {
+    BuildConfig *cfg;
+    int64_t time;
+} AgeCheck;
+
+static int dependency_older_than(const char *dep, void *ctx) {
+    AgeCheck *check = ctx;
+    int64_t dep_time;
+    return build_mtime_ns(check->cfg, dep, &dep_time) && dep_time <= check->time;
+}
+
+/* the file a compile or pch job translates, relative to the build directory */
+static void job_source(Executor *ex, Job *job, char *out, size_t size) {
+    if(job->kind == JOB_PCH) {
+        snprintf(out, size, "%s/%s", ex->cfg->source_root, ex->graph->flagsets[job->index].pch);
+    } else {
+        snprintf(out, size, "%s/%s", ex->cfg->source_root, ex->graph->objects[job->index].source);
+    }
+}
+
+/* the .gch a compile job reads, or "" when its flag set has no pch */
+static void job_pch(Executor *ex, Job *job, char *out, size_t size) {
+    char path[192];
+    pch_path(ex->graph, ex->graph->objects[job->index].flagset, path, sizeof(path));
+    if(path[0]) {
+        snprintf(out, size, "obj/%s.gch", path);
+    } else {
+        out[0] = 0;
+    }
+}
+
+/* an object is stale if it is missing or older than its source, its pch or any header named in its .d file */
+static int object_is_stale(Executor *ex, Job *job) {
+    AgeCheck check = { ex->cfg, 0 };
+    int64_t dep_time;
+    if(job->rebuilt_input || !build_mtime_ns(ex->cfg, job->output, &check.time)) return 1;
+
+    char src[256];
+    job_source(ex, job, src, sizeof(src));
+    if(!build_mtime_ns(ex->cfg, src, &dep_time) || dep_time > check.time) return 1;
+
+    if(job->kind == JOB_COMPILE) {
+        char gch[256];
+        job_pch(ex, job, gch, sizeof(gch));
+        if(gch[0] && (!build_mtime_ns(ex->cfg, gch, &dep_time) || dep_time > check.time)) return 1;
+    }
+
+    return for_each_dependency(ex->cfg, job->output, dependency_older_than, &check) != 1;
+}
+
+static int link_is_stale(Executor *ex, Job *job) {
+    int64_t out_time, in_time;
+    if(job->rebuilt_input || !build_mtime_ns(ex->cfg, job->output, &out_time)) return 1;
+
+    int t = job->index;
+    for(int i = 0; i < ex->graph->target_object_count[t]; i++) {
+        BuildObject *obj = &ex->graph->objects[ex->graph->target_objects[t][i]];
+        char path[256];
+        snprintf(path, sizeof(path), "obj/%s", obj->object);
+        if(!build_mtime_ns(ex->cfg, path, &in_time) || in_time > out_time) return 1;
+    }
+    for(int i = 0; i < ex->graph->target_link_count[t]; i++) {
+        char path[256];
+        target_output_path(ex->cfg, &ex->cfg->targets[ex->graph->target_links[t][i]], path, sizeof(path));
+        if(!build_mtime_ns(ex->cfg, path, &in_time) || in_time > out_time) return 1;
+    }
+    return 0;
+}
+
+typedef struct {
+    BuildConfig *cfg;
+    HashDB *db;
+    uint64_t hash;
+} SignatureState;
+
+static int mix_file_hash(const char *path, void *ctx) {
+    SignatureState *sig = ctx;
+    char full[512];
+    uint64_t h;
+    root_path(sig->cfg, path, full, sizeof(full));
+    if(!hash_db_file_hash(sig->db, full, &h)) return 0;
+    sig->hash = hash_bytes(&h, sizeof(h), sig->hash);
+    return 1;
+}
+
+/*
+ * What an output is built from: its command line plus the content of every
+ * input (source and headers for objects, objects and libraries for links).
+ * Objects built against a pch take in the headers the pch was made from
+ * rather than the .gch bytes.
+ * Returns 0 when an input cannot be read or the dependencies are unknown.
+ */
+static int job_signature(Executor *ex, Job *job, const char *cmd, uint64_t *signature) {
+    SignatureState sig = { ex->cfg, &ex->hashes, hash_bytes(cmd, strlen(cmd), 0) };
+
+    if(job->kind != JOB_LINK) {
+        char src[256];
+        job_source(ex, job, src, sizeof(src));
+        if(!mix_file_hash(src, &sig)) return 0;
+        if(for_each_dependency(ex->cfg, job->output, mix_file_hash, &sig) != 1) return 0;
+    }
+    if(job->kind == JOB_COMPILE) {
+        char gch[256];
+        job_pch(ex, job, gch, sizeof(gch));
+        if(gch[0] && for_each_dependency(ex->cfg, gch, mix_file_hash, &sig) != 1) return 0;
+    } else if(job->kind == JOB_LINK) {
+        int t = job->index;
+        for(int i = 0; i < ex->graph->target_object_count[t]; i++) {
+            char path[256];
+            snprintf(path, sizeof(path), "obj/%s", ex->graph->objects[ex->graph->target_objects[t][i]].object);
+            if(!mix_file_hash(path, &sig)) return 0;
+        }
+        for(int i = 0; i < ex->graph->target_link_count[t]; i++) {
+            char path[256];
+            target_output_path(ex->cfg, &ex->cfg->targets[ex->graph->target_links[t][i]], path, sizeof(path));
+            if(!mix_file_hash(path, &sig)) return 0;
+        }
+    }
+
+    *signature = sig.hash;
+    return 1;
+}
+
+/* an output built from byte-identical inputs is current even if timestamps say otherwise */
+static int output_matches_signature(Executor *ex, const char *output, uint64_t signature) {
+    char full[512];
+    uint64_t h;
+    root_path(ex->cfg, output, full, sizeof(full));
+    if(!hash_db_file_hash(&ex->hashes, full, &h)) return 0;
+    if(hash_db_signature(&ex->hashes, full) != signature) return 0;
+
+    /* bring the timestamp forward so mtime checks (and make) agree from now on */
+    utimensat(AT_FDCWD, full, NULL, 0);
+    hash_db_file_hash(&ex->hashes, full, &h);
+    hash_db_set_signature(&ex->hashes, full, signature);
+    return 1;
+}
+
+static void build_command(Executor *ex, Job *job, char *cmd, size_t size) {
+    BuildConfig *cfg = ex->cfg;
+    BuildGraph *graph = ex->graph;
+
+    if(job->kind == JOB_PCH) {
+        char flags[4096];
+        compile_flags(cfg, graph, job->index, flags, sizeof(flags));
+        snprintf(cmd, size, "gcc %s -MMD -MP -x c-header %s/%s -o %s", flags, cfg->source_root, graph->flagsets[job->index].pch, job->output);
+        return;
+    }
+
+    if(job->kind == JOB_COMPILE) {
+        BuildObject *obj = &graph->objects[job->index];
+        char flags[4096], pch[192];
+        compile_flags(cfg, graph, obj->flagset, flags, sizeof(flags));
+        pch_path(graph, obj->flagset, pch, sizeof(pch));
+        if(pch[0]) {
+            snprintf(cmd, size, "gcc %s -Winvalid-pch -include obj/%s -MMD -MP -c %s/%s -o %s", flags, pch, cfg->source_root, obj->source, job->output);
+        } else {
+            snprintf(cmd, size, "gcc %s -MMD -MP -c %s/%s -o %s", flags, cfg->source_root, obj->source, job->output);
+        }
+        return;
+    }
+
+    int t = job->index;
+    Target *target = &cfg->targets[t];
+    size_t len;
+
+    if(target->kind == TARGET_STATIC_LIBRARY) {
+        len = snprintf(cmd, size, "rm -f %s && %s rcs %s", job->output,
+                       cfg->optimize & OPTIMIZE_LTO ? "gcc-ar" : "ar", job->output);
+    } else {
+        if(target->kind == TARGET_SHARED_LIBRARY) {
+            len = snprintf(cmd, size, "gcc -shared -Wl,-soname,lib%s.so", target->name);
+        } else {
+            len = snprintf(cmd, size, "gcc");
+        }
+        if(cfg->optimize && len + 1 < size) {
+            cmd[len++] = ' ';
+            optimize_flags(cfg, cmd + len, size - len);
+            len += strlen(cmd + len);
+        }
+        if((cfg->linker[0] || cfg->debug_split) && len + 1 < size) {
+            cmd[len++] = ' ';
+            link_flags(cfg, cmd + len, size - len);
+            len += strlen(cmd + len);
+        }
+    }
+    for(int i = 0; i < graph->target_object_count[t] && len < size; i++)
+        len += snprintf(cmd + len, size - len, " obj/%s", graph->objects[graph->target_objects[t][i]].object);
+    if(target->kind == TARGET_STATIC_LIBRARY) return;
+
+    int has_shared = 0;
+    for(int i = 0; i < graph->target_link_count[t] && len < size; i++) {
+        char path[256];
+        Target *lib = &cfg->targets[graph->target_links[t][i]];
+        target_output_path(cfg, lib, path, sizeof(path));
+        len += snprintf(cmd + len, size - len, " %s", path);
+        if(lib->kind == TARGET_SHARED_LIBRARY) has_shared = 1;
+    }
+    if(len < size) len += snprintf(cmd + len, size - len, " -o %s", job->output);
+    for(int i = 0; i < target->ldflag_count && len < size; i++)
+        len += snprintf(cmd + len, size - len, " %s", target->ldflags[i]);
+    for(int i = 0; i < graph->target_link_count[t]; i++) {
+        Target *lib = &cfg->targets[graph->target_links[t][i]];
+        if(lib->kind != TARGET_STATIC_LIBRARY) continue;
+        for(int j = 0; j < lib->ldflag_count && len < size; j++)
+            len += snprintf(cmd + len, size - len, " %s", lib->ldflags[j]);
+    }
+    if(has_shared && len < size)
+        snprintf(cmd + len, size - len, " -Wl,-rpath,'$ORIGIN'");
+}
+
+/* run a shell command from the build directory in its own process group, collecting its output */
+static int run_command(Executor *ex, int worker, const char *cmd, char **output) {
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) != 0) return -1;
+
+    pid_t pid = fork();
+    if(pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+    if(pid == 0) {
+        setpgid(0, 0);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        if(chdir(ex->cfg->build_dir) != 0) _exit(127);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+
+    setpgid(pid, pid);
+    pthread_mutex_lock(&ex->state_lock);
+    __atomic_store_n(&ex->running[worker], pid, __ATOMIC_SEQ_CST);
+    int failed = ex->failed;
+    pthread_mutex_unlock(&ex->state_lock);
+    if(failed) killpg(pid, SIGTERM);
+    close(fds[1]);
+
+    size_t cap = 1024, len = 0;
+    char *buf = malloc(cap);
+    ssize_t n;
+    while(buf && (n = read(fds[0], buf + len, cap - len - 1)) > 0) {
+        len += n;
+        if(cap - len < 512) {
+            char *grown = realloc(buf, cap * 2);
+            if(!grown) break;
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    close(fds[0]);
+    if(buf) buf[len] = 0;
+    *output = buf;
+
+    int status;
+    while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+
+    pthread_mutex_lock(&ex->state_lock);
+    __atomic_store_n(&ex->running[worker], 0, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&ex->state_lock);
+
+    if(WIFEXITED(status)) return WEXITSTATUS(status);
+    return -1;
+}
+
+/* the remote slot a worker thread owns, or -1 for local threads and retired slots */
+static int remote_slot(Executor *ex, int worker) {
+    int slot = worker - ex->local_workers;
+    if(slot < 0 || slot >= ex->remote.slot_count || ex->remote.slots[slot].dead) return -1;
+    return slot;
+}
+
+/*
+ * Compile through the object cache and remote workers: preprocess (which
+ * also writes the .d file), look the result up, and only compile on a
+ * miss, on the thread's worker when it has one. A pch cannot be expanded
+ * by the preprocessor, so its header is included directly. Units whose
+ * flags a worker would refuse are compiled here.
+ */
+static int run_compile(Executor *ex, int worker, Job *job, const char *cmd, char **output, int *cached, const char **host) {
+    *cached = 0;
+    *host = NULL;
+    int slot = remote_slot(ex, worker);
+    /*
+     * profile-use objects depend on .gcda data the preprocessed source does not show,
+     * and split-dwarf objects need a .dwo that neither the cache nor a worker returns
+     */
+    if(job->kind != JOB_COMPILE || (!ex->cache.enabled && slot < 0) ||
+       (ex->cfg->optimize & OPTIMIZE_PGO) || ex->cfg->debug_split)
+        return run_command(ex, worker, cmd, output);
+
+    BuildObject *obj = &ex->graph->objects[job->index];
+    char flags[4096], pre[8192], preprocessed[512], full[512];
+    compile_flags(ex->cfg, ex->graph, obj->flagset, flags, sizeof(flags));
+    FlagSet *fs = &ex->graph->flagsets[obj->flagset];
+    size_t flags_len = strlen(flags);
+    if(fs->pch[0])
+        snprintf(flags + flags_len, sizeof(flags) - flags_len, " -include %s/%s", ex->cfg->source_root, fs->pch);
+    snprintf(pre, sizeof(pre), "gcc %s -E -MMD -MP -MF %.*s.d -MT %s %s/%s -o %s.i",
+             flags, (int)(strrchr(job->output, '.') - job->output), job->output, job->output,
+             ex->cfg->source_root, obj->source, job->output);
+    snprintf(preprocessed, sizeof(preprocessed), "%s/%s.i", ex->cfg->build_dir, job->output);
+    snprintf(full, sizeof(full), "%s/%s", ex->cfg->build_dir, job->output);
+
+    char *pre_output = NULL;
+    uint64_t key;
+    int result = run_command(ex, worker, pre, &pre_output);
+    free(pre_output);
+    int have_key = result == 0 && ex->cache.enabled && object_cache_key(&ex->cache, preprocessed, cmd, &key);
+
+    /* if preprocessing failed the real compile reports the error */
+    if(result != 0 || (ex->cache.enabled && !have_key)) {
+        unlink(preprocessed);
+        return run_command(ex, worker, cmd, output);
+    }
+
+    if(have_key && object_cache_fetch(&ex->cache, key, full)) {
+        unlink(preprocessed);
+        *cached = 1;
+        return 0;
+    }
+
+    /* the worker compiles the preprocessed text; a broken connection falls back to a local compile */
+    char sent[4096];
+    flags[flags_len] = 0;
+    if(slot >= 0 && remote_flags(flags, sent, sizeof(sent)) && remote_connect(&ex->remote, slot)) {
+        result = remote_compile(&ex->remote.slots[slot], sent, preprocessed, full, output);
+        if(result == -2) {
+            remote_disconnect(&ex->remote, slot);
+            /* cut off by executor_cancel: fail the job instead of compiling it here */
+            if(ex->cancelled) {
+                unlink(preprocessed);
+                return -1;
+            }
+        } else if(result == REMOTE_REFUSED) {
+            free(*output);
+            *output = NULL;
+        } else {
+            unlink(preprocessed);
+            *host = ex->remote.hosts[ex->remote.slots[slot].host];
+            __sync_fetch_and_add(&ex->remote_compiles, 1);
+            if(result == 0 && have_key) object_cache_store(&ex->cache, key, full);
+            return result;
+        }
+    }
+    unlink(preprocessed);
+    if(!have_key) return run_command(ex, worker, cmd, output);
+
+    /* keep absolute checkout paths out of debug info so the object is reusable elsewhere */
+    char mapped[8800];
+    snprintf(mapped, sizeof(mapped), "%s -ffile-prefix-map=%s=.", cmd, ex->cache.root);
+    result = run_command(ex, worker, mapped, output);
+    if(result == 0) object_cache_store(&ex->cache, key, full);
+    return result;
+}
+
+static Executor *volatile active_executor;
+
+/*
+ * Stop the running build from a signal handler, the way a failed job stops
+ * it: no new work is handed out, running commands are terminated and their
+ * half-written outputs removed, and objects that finished are kept. Watch
+ * mode cancels stale builds this way. The state lock cannot be taken here,
+ * so the running pids are read atomically, and remote compiles are cut off
+ * by breaking their connections; their threads then fail the job and leave
+ * through abort_build, so the content hashes are still saved.
+ */
+void executor_cancel(void) {
+    Executor *ex = active_executor;
+    if(!ex) return;
+    ex->cancelled = 1;
+    ex->failed = 1;
+    for(int i = 0; i < ex->worker_count; i++) {
+        pid_t pid = __atomic_load_n(&ex->running[i], __ATOMIC_SEQ_CST);
+        if(pid > 0) killpg(pid, SIGTERM);
+    }
+    remote_pool_interrupt(&ex->remote);
+}
+
+/* first failure wins: stop handing out work and terminate whatever is still compiling */
+static void abort_build(Executor *ex) {
+    pthread_mutex_lock(&ex->state_lock);
+    ex->failed = 1;
+    for(int i = 0; i < ex->worker_count; i++) {
+        if(ex->running[i] > 0) killpg(ex->running[i], SIGTERM);
+    }
+    pthread_cond_broadcast(&ex->state_cond);
+    pthread_mutex_unlock(&ex->state_lock);
+}
+
+/* returns 0 when skipped, 1 when the output changed, 2 when it was rebuilt byte-identical, -1 on failure */
+static int execute_job(Executor *ex, int worker, Job *job) {
+    int stale;
+    if(job->kind != JOB_LINK) {
+        stale = object_is_stale(ex, job);
+    } else {
+        stale = link_is_stale(ex, job);
+    }
+    if(!stale) return 0;
+
+    char cmd[8192];
+    build_command(ex, job, cmd, sizeof(cmd));
+
+    uint64_t signature;
+    if(job_signature(ex, job, cmd, &signature) && output_matches_signature(ex, job->output, signature)) {
+        __sync_fetch_and_add(&ex->unchanged, 1);
+        return 0;
+    }
+
+    char full[512];
+    uint64_t old_hash, new_hash;
+    root_path(ex->cfg, job->output, full, sizeof(full));
+    int had_output = hash_db_cached_hash(&ex->hashes, full, &old_hash);
+
+    char *output = NULL;
+    int cached = 0;
+    const char *host = NULL;
+    int64_t start_us = trace_now_us();
+    int result = run_compile(ex, worker, job, cmd, &output, &cached, &host);
+    if(trace_enabled()) {
+        if(job->kind == JOB_COMPILE) {
+            trace_span(cached ? "cache" : "compile", ex->graph->objects[job->index].source, worker + 1, start_us);
+        } else if(job->kind == JOB_PCH) {
+            trace_span("pch", ex->graph->flagsets[job->index].pch, worker + 1, start_us);
+        } else {
+            trace_span("link", job->output, worker + 1, start_us);
+        }
+    }
+
+    pthread_mutex_lock(&ex->output_lock);
+    pthread_mutex_lock(&ex->state_lock);
+    int step = ++ex->executed;
+    int aborted = ex->failed;
+    pthread_mutex_unlock(&ex->state_lock);
+
+    if(result == 0) {
+        if(job->kind == JOB_COMPILE) {
+            printf(DIM "[%d]" RESET " " CYAN "CC" RESET "    %s%s%s%s%s\n", step, ex->graph->objects[job->index].source,
+                   cached ? DIM " (cached)" RESET : "", host ? DIM " on " : "", host ? host : "", host ? RESET : "");
+        } else if(job->kind == JOB_PCH) {
+            printf(DIM "[%d]" RESET " " CYAN "PCH" RESET "   %s\n", step, ex->graph->flagsets[job->index].pch);
+        } else {
+            printf(DIM "[%d]" RESET " " BRIGHT_BLUE "LINK" RESET "  %s\n", step, job->output);
+        }
+    } else if(!aborted) {
+        printf(BRIGHT_RED "FAILED:" RESET " %s\n" DIM "%s" RESET "\n", job->output, cmd);
+    }
+    if(output && output[0] && !(result != 0 && aborted)) fputs(output, stdout);
+    fflush(stdout);
+    pthread_mutex_unlock(&ex->output_lock);
+    free(output);
+
+    if(result != 0) {
+        /* never leave a half-written output behind for the next build to trust */
+        unlink(full);
+        return -1;
+    }
+
+    /* compiles learn their header list from the fresh .d file, so sign them afterwards */
+    if(job->kind == JOB_LINK || job_signature(ex, job, cmd, &signature)) {
+        hash_db_set_signature(&ex->hashes, full, signature);
+    }
+    if(had_output && hash_db_cached_hash(&ex->hashes, full, &new_hash) && new_hash == old_hash) return 2;
+    return 1;
+}
+
+static void release_job(Executor *ex, int worker, int j, int rebuilt) {
+    Job *dep = &ex->jobs[j];
+    if(rebuilt) __sync_fetch_and_or(&dep->rebuilt_input, 1);
+    if(__sync_sub_and_fetch(&dep->pending, 1) == 0 && !dep->skipped) push_job(ex, worker, j);
+}
+
+static void finish_job(Executor *ex, int worker, Job *job, int rebuilt) {
+    /* a pch gates every compile of its flag set; object jobs share their object's index */
+    if(job->kind == JOB_PCH) {
+        for(int i = 0; i < ex->graph->object_count; i++) {
+            if(ex->graph->objects[i].flagset == job->index) release_job(ex, worker, i, rebuilt);
+        }
+    }
+    for(int i = 0; i < job->dependent_count; i++)
+        release_job(ex, worker, job->dependents[i], rebuilt);
+
+    pthread_mutex_lock(&ex->state_lock);
+    ex->remaining--;
+    pthread_cond_broadcast(&ex->state_cond);
+    pthread_mutex_unlock(&ex->state_lock);
+}
+
+static void *worker_main(void *arg) {
+    Worker *w = arg;
+    Executor *ex = w->ex;
+
+    while(1) {
+        pthread_mutex_lock(&ex->state_lock);
+        while(!ex->failed && ex->remaining > 0 && ex->queued == 0) {
+            pthread_cond_wait(&ex->state_cond, &ex->state_lock);
+        }
+        int done = ex->failed || ex->remaining == 0;
+        pthread_mutex_unlock(&ex->state_lock);
+        if(done) break;
+
+        int j = next_job(ex, w->id);
+        if(j < 0) continue;
+
+        int result = execute_job(ex, w->id, &ex->jobs[j]);
+        if(result < 0) {
+            abort_build(ex);
+            break;
+        }
+        finish_job(ex, w->id, &ex->jobs[j], result == 1);
+    }
+    return NULL;
+}
+
+static void add_dependent(Executor *ex, int job, int dependent) {
+    Job *j = &ex->jobs[job];
+    for(int i = 0; i < j->dependent_count; i++) {
+        if(j->dependents[i] == dependent) return;
+    }
+    j->dependents[j->dependent_count++] = dependent;
+    ex->jobs[dependent].pending++;
+}
+
+static void plan_jobs(Executor *ex) {
+    BuildConfig *cfg = ex->cfg;
+    BuildGraph *graph = ex->graph;
+
+    for(int i = 0; i < graph->object_count; i++) {
+        Job *job = &ex->jobs[ex->job_count++];
+        job->kind = JOB_COMPILE;
+        job->index = i;
+        snprintf(job->output, sizeof(job->output), "obj/%s", graph->objects[i].object);
+    }
+
+    for(int i = 0; i < graph->flagset_count; i++) {
+        char path[192];
+        pch_path(graph, i, path, sizeof(path));
+        if(!path[0]) continue;
+
+        Job *job = &ex->jobs[ex->job_count++];
+        job->kind = JOB_PCH;
+        job->index = i;
+        snprintf(job->output, sizeof(job->output), "obj/%s.gch", path);
+        for(int o = 0; o < graph->object_count; o++) {
+            if(graph->objects[o].flagset == i) ex->jobs[o].pending++;
+        }
+
+        char dir[256];
+        snprintf(dir, sizeof(dir), "%s/%s", cfg->build_dir, job->output);
+        *strrchr(dir, '/') = 0;
+        create_directory_recursive(dir);
+    }
+
+    int link_base = ex->job_count;
+    for(int t = 0; t < cfg->target_count; t++) {
+        Job *job = &ex->jobs[ex->job_count++];
+        job->kind = JOB_LINK;
+        job->index = t;
+        target_output_path(cfg, &cfg->targets[t], job->output, sizeof(job->output));
+    }
+
+    for(int t = 0; t < cfg->target_count; t++) {
+        for(int i = 0; i < graph->target_object_count[t]; i++)
+            add_dependent(ex, graph->target_objects[t][i], link_base + t);
+        for(int i = 0; i < graph->target_link_count[t]; i++)
+            add_dependent(ex, link_base + graph->target_links[t][i], link_base + t);
+    }
+}
+
+/* skip every job that no selected target needs: a job stays if a job that stays depends on it */
+static int select_jobs(Executor *ex, const int *selected) {
+    int link_base = ex->job_count - ex->cfg->target_count;
+    for(int j = 0; j < ex->job_count; j++)
+        ex->jobs[j].skipped = j < link_base || !selected[ex->jobs[j].index];
+
+    int changed = 1;
+    while(changed) {
+        changed = 0;
+        for(int j = 0; j < ex->job_count; j++) {
+            Job *job = &ex->jobs[j];
+            if(!job->skipped) continue;
+            for(int i = 0; i < job->dependent_count && job->skipped; i++) {
+                if(!ex->jobs[job->dependents[i]].skipped) job->skipped = 0;
+            }
+            /* a pch gates the compiles of its flag set */
+            for(int o = 0; job->kind == JOB_PCH && job->skipped && o < ex->graph->object_count; o++) {
+                if(ex->graph->objects[o].flagset == job->index && !ex->jobs[o].skipped) job->skipped = 0;
+            }
+            if(!job->skipped) changed = 1;
+        }
+    }
+
+    int count = 0;
+    for(int j = 0; j < ex->job_count; j++) {
+        if(!ex->jobs[j].skipped) count++;
+    }
+    return count;
+}
+
+int execute_build(BuildConfig *cfg, int jobs) {
+    return execute_targets(cfg, jobs, NULL);
+}
+
+/* build only the targets set in selected (NULL for all) and what they link */
+int execute_targets(BuildConfig *cfg, int jobs, const int *selected) {
+    BuildGraph *graph = build_graph_create(cfg);
+    if(!graph) return 0;
+    int ok = execute_graph_targets(cfg, graph, jobs, selected);
+    build_graph_free(graph);
+    return ok;
+}
+
+/* build from an existing graph, which the caller keeps (the daemon holds one across builds) */
+int execute_graph(BuildConfig *cfg, BuildGraph *graph, int jobs) {
+    return execute_graph_targets(cfg, graph, jobs, NULL);
+}
+
+int execute_graph_targets(BuildConfig *cfg, BuildGraph *graph, int jobs, const int *selected) {
+    char path[300];
+    snprintf(path, sizeof(path), "%s/obj", cfg->build_dir);
+    if(!create_directory_recursive(path)) return 0;
+    if(strcmp(cfg->output_dir, ".") != 0) {
+        snprintf(path, sizeof(path), "%s/%s", cfg->build_dir, cfg->output_dir);
+        if(!create_directory_recursive(path)) return 0;
+    }
+
+    Executor *ex = calloc(1, sizeof(Executor));
+    if(!ex) {
+        fprintf(stderr, "Error: Out of memory starting the build\n");
+        return 0;
+    }
+    ex->cfg = cfg;
+    ex->graph = graph;
+
+    plan_jobs(ex);
+    int planned = selected ? select_jobs(ex, selected) : ex->job_count;
+    ex->remaining = planned;
+    snprintf(path, sizeof(path), "%s/.anvil_hashes", cfg->build_dir);
+    hash_db_load(&ex->hashes, path);
+    object_cache_init(&ex->cache, cfg);
+
+    if(jobs < 1) jobs = default_job_count();
+    if(jobs > MAX_WORKERS) jobs = MAX_WORKERS;
+    if(jobs > planned) jobs = planned > 0 ? planned : 1;
+    ex->local_workers = jobs;
+
+    /* each remote slot gets a thread of its own: it preprocesses here and compiles on the worker */
+    const char *remote_list = getenv("ANVIL_WORKERS");
+    if(!remote_list) remote_list = cfg->workers;
+    if(remote_list[0] && !(cfg->optimize & OPTIMIZE_PGO) && !cfg->debug_split)
+        jobs += remote_pool_init(&ex->remote, remote_list);
+    ex->worker_count = jobs;
+
+    ex->deques = calloc(jobs, sizeof(JobDeque));
+    Worker *workers = calloc(jobs, sizeof(Worker));
+    pthread_t *threads = calloc(jobs, sizeof(pthread_t));
+    if(!ex->deques || !workers || !threads) {
+        fprintf(stderr, "Error: Out of memory starting the build\n");
+        free(ex->deques);
+        free(workers);
+        free(threads);
+        remote_pool_free(&ex->remote);
+        free(ex);
+        return 0;
+    }
+
+    pthread_mutex_init(&ex->state_lock, NULL);
+    pthread_cond_init(&ex->state_cond, NULL);
+    pthread_mutex_init(&ex->output_lock, NULL);
+    for(int i = 0; i < jobs; i++) pthread_mutex_init(&ex->deques[i].lock, NULL);
+
+    /* seed ready jobs round-robin; everything else is unlocked by finishing dependencies */
+    int seeded = 0;
+    for(int j = 0; j < ex->job_count; j++) {
+        if(ex->jobs[j].pending == 0 && !ex->jobs[j].skipped) push_job(ex, seeded++ % jobs, j);
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int64_t start_us = trace_now_us();
+    int mark = trace_mark();
+
+    active_executor = ex;
+    for(int i = 0; i < jobs; i++) {
+        workers[i].ex = ex;
+        workers[i].id = i;
+        pthread_create(&threads[i], NULL, worker_main, &workers[i]);
+    }
+    for(int i = 0; i < jobs; i++) pthread_join(threads[i], NULL);
+    active_executor = NULL;
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    trace_span("phase", "execute_build", 0, start_us);
+    double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    hash_db_save(&ex->hashes);
+    hash_db_free(&ex->hashes);
+
+    int ok = !ex->failed;
+    if(ex->cancelled) {
+        printf(DIM "Build cancelled" RESET "\n");
+    } else if(!ok) {
+        printf(BRIGHT_RED "Build stopped after the first error" RESET "\n");
+    } else if(ex->executed == 0) {
+        printf(DIM "Everything is up to date" RESET "\n");
+    } else {
+        printf(DIM "Ran %d of %d jobs in %.2fs on %d worker%s" RESET "\n", ex->executed, planned, elapsed, jobs, jobs == 1 ? "" : "s");
+    }
+    if(ex->remote_compiles > 0) {
+        printf(DIM "Compiled %d object%s on %d remote slot%s" RESET "\n", ex->remote_compiles, ex->remote_compiles == 1 ? "" : "s",
+               ex->remote.slot_count, ex->remote.slot_count == 1 ? "" : "s");
+    }
+    if(ex->unchanged > 0) {
+        printf(DIM "Skipped %d job%s whose inputs were touched but not changed" RESET "\n", ex->unchanged, ex->unchanged == 1 ? "" : "s");
+    }
+    object_cache_trim(&ex->cache);
+    object_cache_report(&ex->cache);
+    trace_report_slowest(mark, 10);
+
+    for(int i = 0; i < jobs; i++) pthread_mutex_destroy(&ex->deques[i].lock);
+    pthread_mutex_destroy(&ex->state_lock);
+    pthread_cond_destroy(&ex->state_cond);
+    pthread_mutex_destroy(&ex->output_lock);
+    remote_pool_free(&ex->remote);
+    free(threads);
+    free(workers);
+    free(ex->deques);
+    free(ex);
+    return ok;
+}
@@ -0,0 +1,283 @@
+#include "anvil.h"
+
+/*
+ * turn a source path into a flat object stem: src/net/io.c -> src_net_io.
+ * '/' is the only character written as a bare '_'; '_' and '-' become
+ * "-_" and "--", and anything else "-xx" in hex, so src/a_b.c (src_a-_b)
+ * and src/a/b.c (src_a_b) keep apart.
+ */
+static void object_stem(const char *source, char *stem, size_t size) {
+    char path[128];
+    snprintf(path, sizeof(path), "%s", source);
+
+    char *dot = strrchr(path, '.');
+    char *slash = strrchr(path, '/');
+    if(dot && (!slash || dot > slash)) *dot = 0;
+
+    size_t len = 0;
+    stem[0] = 0;
+    for(const char *p = path; *p && len + 4 < size; p++) {
+        unsigned char c = (unsigned char)*p;
+        if(isalnum(c)) stem[len++] = (char)c;
+        else if(c == '/') stem[len++] = '_';
+        else if(c == '_' || c == '-') { stem[len++] = '-'; stem[len++] = (char)c; }
+        else len += snprintf(stem + len, size - len, "-%02x", c);
+    }
+    stem[len] = 0;
+}
+
+/* flags a target compiles with on top of the global CFLAGS */
+static void target_extra_flags(const Target *target, char *out, size_t size) {
+    out[0] = 0;
+    size_t len = 0;
+    for(int i = 0; i < target->cflag_count && len < size; i++) {
+        len += snprintf(out + len, size - len, "%s%s", len ? " " : "", target->cflags[i]);
+    }
+    if(target->kind == TARGET_SHARED_LIBRARY && len < size) {
+        snprintf(out + len, size - len, "%s-fPIC", len ? " " : "");
+    }
+}
+
+/* a target's own pch overrides the global one; "none" opts out */
+static const char *target_pch(BuildConfig *cfg, const Target *target) {
+    if(strcmp(target->pch, "none") == 0) return "";
+    return target->pch[0] ? target->pch : cfg->pch;
+}
+
+int find_target(BuildConfig *cfg, const char *name) {
+    for(int t = 0; t < cfg->target_count; t++) {
+        if(strcmp(cfg->targets[t].name, name) == 0) return t;
+    }
+    return -1;
+}
+
+void target_output_name(const Target *target, char *out, size_t size) {
+    switch(target->kind) {
+        case TARGET_STATIC_LIBRARY: snprintf(out, size, "lib%s.a", target->name); break;
+        case TARGET_SHARED_LIBRARY: snprintf(out, size, "lib%s.so", target->name); break;
+        default: snprintf(out, size, "%s", target->name); break;
+    }
+}
+
+/* where a target's output lands, relative to the build directory */
+void target_output_path(BuildConfig *cfg, const Target *target, char *out, size_t size) {
+    char name[160];
+    target_output_name(target, name, sizeof(name));
+    if(strcmp(cfg->output_dir, ".") == 0) {
+        snprintf(out, size, "%s", name);
+    } else {
+        snprintf(out, size, "%s/%s", cfg->output_dir, name);
+    }
+}
+
+/* the complete compile flags of a flag set, spelled as the generated Makefile expands them */
+void compile_flags(BuildConfig *cfg, BuildGraph *graph, int flagset, char *out, size_t size) {
+    size_t len = snprintf(out, size, "-DVERSION=\\\"%s\\\"", cfg->version);
+    for(int i = 0; i < cfg->cflag_count && len < size; i++)
+        len += snprintf(out + len, size - len, " %s", cfg->cflags[i]);
+    for(int i = 0; i < cfg->include_count && len < size; i++)
+        len += snprintf(out + len, size - len, " -I%s/%s", cfg->source_root, cfg->includes[i]);
+    if(cfg->optimize && len + 1 < size) {
+        out[len++] = ' ';
+        optimize_flags(cfg, out + len, size - len);
+        len += strlen(out + len);
+    }
+    if(cfg->debug_split && len + 1 < size) {
+        out[len++] = ' ';
+        debug_flags(cfg, out + len, size - len);
+        len += strlen(out + len);
+    }
+    if(graph->flagsets[flagset].flags[0] && len < size)
+        snprintf(out + len, size - len, " %s", graph->flagsets[flagset].flags);
+}
+
+/*
+ * LTO and PGO flags, passed to compiles and links alike. The profile
+ * directory is absolute so instrumented binaries write their .gcda files
+ * there whatever directory the training run starts from.
+ */
+void optimize_flags(BuildConfig *cfg, char *out, size_t size) {
+    size_t len = 0;
+    out[0] = 0;
+    if(cfg->optimize & OPTIMIZE_LTO)
+        len += snprintf(out, size, "-flto=auto");
+    if(!(cfg->optimize & OPTIMIZE_PGO) || len >= size) return;
+
+    char root[256];
+    if(!getcwd(root, sizeof(root))) strcpy(root, ".");
+    if(cfg->pgo_stage == PGO_GENERATE) {
+        snprintf(out + len, size - len, "%s-fprofile-generate=%s/%s/pgo", len ? " " : "", root, cfg->build_dir);
+    } else {
+        /* a profile older than the code only loses its benefit for the functions that changed */
+        snprintf(out + len, size - len, "%s-fprofile-use=%s/%s/pgo -fprofile-partial-training "
+                 "-Wno-missing-profile -Wno-error=coverage-mismatch", len ? " " : "", root, cfg->build_dir);
+    }
+}
+
+/* the name (under obj/) a flag set's sources force-include; gcc picks up the .gch next to it. Empty without a pch */
+void pch_path(BuildGraph *graph, int flagset, char *out, size_t size) {
+    FlagSet *fs = &graph->flagsets[flagset];
+    if(!fs->pch[0]) {
+        out[0] = 0;
+        return;
+    }
+    const char *slash = strrchr(fs->pch, '/');
+    const char *base = slash ? slash + 1 : fs->pch;
+    if(fs->name[0]) {
+        snprintf(out, size, "pch/%s/%s", fs->name, base);
+    } else {
+        snprintf(out, size, "pch/%s", base);
+    }
+}
+
+/* depth-first post-order over links; state: 0 unvisited, 1 on stack, 2 done */
+static int visit_links(BuildConfig *cfg, int t, int *state, int *order, int *count) {
+    if(state[t] == 2) return 1;
+    if(state[t] == 1) {
+        fprintf(stderr, "Error: Circular library dependency involving '%s'\n", cfg->targets[t].name);
+        return 0;
+    }
+
+    /* walk links backwards so the reversed post-order keeps the declared order */
+    state[t] = 1;
+    for(int i = cfg->targets[t].link_count - 1; i >= 0; i--) {
+        int dep = find_target(cfg, cfg->targets[t].links[i]);
+        if(dep >= 0 && !visit_links(cfg, dep, state, order, count)) return 0;
+    }
+    state[t] = 2;
+    order[(*count)++] = t;
+    return 1;
+}
+
+/* all libraries a target needs, ordered so that each library precedes the ones it depends on */
+static int resolve_links(BuildConfig *cfg, BuildGraph *graph, int t) {
+    int state[MAX_TARGETS] = {0};
+    int order[MAX_TARGETS];
+    int count = 0;
+
+    if(!visit_links(cfg, t, state, order, &count)) return 0;
+
+    /* post-order ends with the target itself; reverse the rest */
+    graph->target_link_count[t] = 0;
+    for(int i = count - 2; i >= 0; i--) {
+        graph->target_links[t][graph->target_link_count[t]++] = order[i];
+    }
+    return 1;
+}
+
+static int find_or_add_flagset(BuildGraph *graph, const char *flags, const char *pch) {
+    for(int i = 0; i < graph->flagset_count; i++) {
+        if(strcmp(graph->flagsets[i].flags, flags) == 0 && strcmp(graph->flagsets[i].pch, pch) == 0) return i;
+    }
+
+    FlagSet *fs = &graph->flagsets[graph->flagset_count];
+    snprintf(fs->flags, sizeof(fs->flags), "%s", flags);
+    snprintf(fs->pch, sizeof(fs->pch), "%s", pch);
+    if(pch[0]) {
+        char key[MAX_LINE + 160];
+        snprintf(key, sizeof(key), "%s\n%s", flags, pch);
+        fs->hash = hash_string(key);
+    } else {
+        fs->hash = hash_string(flags);
+    }
+
+    /* the first set holds the global settings and keeps plain object names */
+    if(graph->flagset_count == 0) {
+        fs->name[0] = 0;
+    } else {
+        snprintf(fs->name, sizeof(fs->name), "%08x", (unsigned)(fs->hash & 0xffffffffu));
+    }
+    return graph->flagset_count++;
+}
+
+static int find_or_add_object(BuildGraph *graph, const char *source, int flagset) {
+    for(int i = 0; i < graph->object_count; i++) {
+        if(graph->objects[i].flagset == flagset && strcmp(graph->objects[i].source, source) == 0) {
+            return i;
+        }
+    }
+    if(graph->object_count >= MAX_OBJECTS) return -1;
+
+    BuildObject *obj = &graph->objects[graph->object_count];
+    char stem[160], suffix[16];
+    snprintf(suffix, sizeof(suffix), "%s", graph->flagsets[flagset].name);
+    object_stem(source, stem, sizeof(stem));
+
+    snprintf(obj->source, sizeof(obj->source), "%s", source);
+    obj->flagset = flagset;
+
+    /* long paths truncate and a flag set suffix can mimic an escape, so number
+       any name already taken rather than let one object overwrite another */
+    for(int n = 1;; n++) {
+        char tail[32];
+        if(n == 1) tail[0] = 0;
+        else snprintf(tail, sizeof(tail), "-%d", n);
+
+        if(suffix[0]) {
+            snprintf(obj->object, sizeof(obj->object), "%.160s%s-%s.o", stem, tail, suffix);
+        } else {
+            snprintf(obj->object, sizeof(obj->object), "%.160s%s.o", stem, tail);
+        }
+
+        int taken = 0;
+        for(int i = 0; i < graph->object_count && !taken; i++) {
+            taken = strcmp(graph->objects[i].object, obj->object) == 0;
+        }
+        if(!taken) break;
+    }
+    return graph->object_count++;
+}
+
+BuildGraph *build_graph_create(BuildConfig *cfg) {
+    BuildGraph *graph = calloc(1, sizeof(BuildGraph));
+    if(!graph) {
+        fprintf(stderr, "Error: Out of memory building the dependency graph\n");
+        return NULL;
+    }
+
+    /* the global flag set always exists so plain objects keep stable names */
+    find_or_add_flagset(graph, "", cfg->pch);
+
+    for(int t = 0; t < cfg->target_count; t++) {
+        Target *target = &cfg->targets[t];
+        char extra[MAX_LINE];
+        target_extra_flags(target, extra, sizeof(extra));
+
+        int fs = find_or_add_flagset(graph, extra, target_pch(cfg, target));
+        graph->target_flagset[t] = fs;
+        graph->target_object_count[t] = 0;
+
+        /* in unity mode the objects come from the generated batch files instead */
+        const char (*sources)[128] = target->sources;
+        int source_count = target->source_count;
+        if(cfg->unity && !target->no_unity) {
+            source_count = unity_sources(cfg, target, graph->unity_sources, MAX_SOURCES);
+            if(source_count < 0) {
+                free(graph);
+                return NULL;
+            }
+            sources = graph->unity_sources;
+        }
+
+        for(int i = 0; i < source_count; i++) {
+            int obj = find_or_add_object(graph, sources[i], fs);
+            if(obj < 0) {
+                fprintf(stderr, "Error: Too many objects (max %d)\n", MAX_OBJECTS);
+                free(graph);
+                return NULL;
+            }
+            graph->target_objects[t][graph->target_object_count[t]++] = obj;
+        }
+
+        if(!resolve_links(cfg, graph, t)) {
+            free(graph);
+            return NULL;
+        }
+    }
+
+    return graph;
+}
+
+void build_graph_free(BuildGraph *graph) {
+    free(graph);
+}
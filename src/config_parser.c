@@ -1,5 +1,23 @@
 #include "anvil.h"
 
+/* "lto", "pgo", both, or "none"; returns -1 for anything else */
+static int parse_optimize(const char *value) {
+    char value_copy[MAX_LINE];
+    snprintf(value_copy, sizeof(value_copy), "%s", value);
+    int optimize = 0;
+    for(char *mode = strtok(value_copy, " \t"); mode; mode = strtok(NULL, " \t")) {
+        if(strcmp(mode, "lto") == 0) {
+            optimize |= OPTIMIZE_LTO;
+        } else if(strcmp(mode, "pgo") == 0) {
+            optimize |= OPTIMIZE_PGO;
+        } else if(strcmp(mode, "none") != 0) {
+            fprintf(stderr, "Error: Unknown optimize mode '%s' (use lto, pgo or both)\n", mode);
+            return -1;
+        }
+    }
+    return optimize;
+}
+
 int parse_buildfile(const char *filename, BuildConfig *cfg) {
     FILE *f = fopen(filename, "r");
     if(!f) {
@@ -10,32 +28,62 @@ int parse_buildfile(const char *filename, BuildConfig *cfg) {
     memset(cfg, 0, sizeof(BuildConfig));
     strcpy(cfg->output_dir, ".");
     strcpy(cfg->version, "1.0.0");  // Default version 
+    strcpy(cfg->build_dir, "build");
+    strcpy(cfg->source_root, "..");
+    snprintf(cfg->config_file, sizeof(cfg->config_file), "%s", filename);
+    cfg->watch_debounce_ms = DEFAULT_WATCH_DEBOUNCE_MS;
+    cfg->run_stop_timeout_ms = DEFAULT_RUN_STOP_TIMEOUT_MS;
 
     char line[MAX_LINE];
     int in_target_block = 0;
     Target *current_target = NULL;
+    Variant *current_variant = NULL;
 
     while(fgets(line, MAX_LINE, f)) {
         trim(line);
         if(line[0] == '#' || line[0] == 0) continue;
 
-        /* check for target block start */
-        if(strncmp(line, "[target:", 8) == 0) {
-            char *end = strchr(line + 8, ']');
-            if(end && cfg->target_count < 16) {
+        /* check for target or library block start */
+        int is_library = strncmp(line, "[library:", 9) == 0;
+        if(is_library || strncmp(line, "[target:", 8) == 0) {
+            char *name = line + (is_library ? 9 : 8);
+            char *end = strchr(name, ']');
+            if(end && cfg->target_count < MAX_TARGETS) {
                 *end = 0;
                 current_target = &cfg->targets[cfg->target_count];
-                strcpy(current_target->name, line + 8);
+                strcpy(current_target->name, name);
+                current_target->kind = is_library ? TARGET_STATIC_LIBRARY : TARGET_EXECUTABLE;
                 current_target->source_count = 0;
+                current_target->cflag_count = 0;
                 current_target->ldflag_count = 0;
+                current_target->link_count = 0;
+                current_target->pch[0] = 0;
+                current_target->no_unity = 0;
                 cfg->target_count++;
                 in_target_block = 1;
             }
             continue;
         }
 
-        /* check for end of target block */
-        if(strcmp(line, "[/target]") == 0) {
+        /* variant blocks overlay flags on everything else */
+        if(strncmp(line, "[variant:", 9) == 0) {
+            char *name = line + 9;
+            char *end = strchr(name, ']');
+            if(end && cfg->variant_count < MAX_VARIANTS) {
+                *end = 0;
+                current_variant = &cfg->variants[cfg->variant_count++];
+                snprintf(current_variant->name, sizeof(current_variant->name), "%.63s", name);
+                current_variant->optimize = -1;
+            }
+            continue;
+        }
+        if(strcmp(line, "[/variant]") == 0) {
+            current_variant = NULL;
+            continue;
+        }
+
+        /* check for end of target or library block */
+        if(strcmp(line, "[/target]") == 0 || strcmp(line, "[/library]") == 0) {
             in_target_block = 0;
             current_target = NULL;
             continue;
@@ -56,6 +104,21 @@ int parse_buildfile(const char *filename, BuildConfig *cfg) {
             trim(value);
         }
 
+        if(current_variant) {
+            if(strcmp(key, "cflags") == 0) {
+                parse_list(value, current_variant->cflags, &current_variant->cflag_count, MAX_FLAGS);
+            } else if(strcmp(key, "ldflags") == 0) {
+                parse_list(value, current_variant->ldflags, &current_variant->ldflag_count, MAX_FLAGS);
+            } else if(strcmp(key, "optimize") == 0) {
+                current_variant->optimize = parse_optimize(value);
+                if(current_variant->optimize < 0) {
+                    fclose(f);
+                    return 0;
+                }
+            }
+            continue;
+        }
+
         /* handle target-specific properties */
         if(in_target_block && current_target) {
             if(strcmp(key, "sources") == 0) {
@@ -71,8 +134,26 @@ int parse_buildfile(const char *filename, BuildConfig *cfg) {
                     }
                     token = strtok(NULL, " \t");
                 }
+            } else if(strcmp(key, "cflags") == 0) {
+                parse_list(value, current_target->cflags, &current_target->cflag_count, MAX_FLAGS);
             } else if(strcmp(key, "ldflags") == 0) {
                 parse_list(value, current_target->ldflags, &current_target->ldflag_count, MAX_FLAGS);
+            } else if(strcmp(key, "links") == 0) {
+                parse_list(value, current_target->links, &current_target->link_count, MAX_TARGETS);
+            } else if(strcmp(key, "pch") == 0) {
+                snprintf(current_target->pch, sizeof(current_target->pch), "%s", value);
+            } else if(strcmp(key, "unity") == 0) {
+                current_target->no_unity = strcmp(value, "off") == 0 || strcmp(value, "false") == 0 || strcmp(value, "0") == 0;
+            } else if(strcmp(key, "type") == 0 && current_target->kind != TARGET_EXECUTABLE) {
+                if(strcmp(value, "shared") == 0) {
+                    current_target->kind = TARGET_SHARED_LIBRARY;
+                } else if(strcmp(value, "static") == 0) {
+                    current_target->kind = TARGET_STATIC_LIBRARY;
+                } else {
+                    fprintf(stderr, "Error: Unknown library type '%s' for %s (use static or shared)\n", value, current_target->name);
+                    fclose(f);
+                    return 0;
+                }
             }
         } else {
             if(strcmp(key, "project") == 0) {
@@ -100,18 +181,96 @@ int parse_buildfile(const char *filename, BuildConfig *cfg) {
                 parse_list(value, cfg->cflags, &cfg->cflag_count, MAX_FLAGS);
             } else if(strcmp(key, "ldflags") == 0) {
                 parse_list(value, cfg->ldflags, &cfg->ldflag_count, MAX_FLAGS);
+            } else if(strcmp(key, "links") == 0) {
+                parse_list(value, cfg->links, &cfg->link_count, MAX_TARGETS);
+            } else if(strcmp(key, "pch") == 0) {
+                snprintf(cfg->pch, sizeof(cfg->pch), "%s", value);
             } else if(strcmp(key, "output_dir") == 0) {
                 strcpy(cfg->output_dir, value);
+            } else if(strcmp(key, "generator") == 0) {
+                snprintf(cfg->generator, sizeof(cfg->generator), "%s", value);
+            } else if(strcmp(key, "jobs") == 0) {
+                cfg->jobs = atoi(value);
+            } else if(strcmp(key, "cache") == 0) {
+                cfg->cache_enabled = strcmp(value, "on") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+            } else if(strcmp(key, "unity") == 0) {
+                cfg->unity = strcmp(value, "on") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+            } else if(strcmp(key, "workers") == 0) {
+                snprintf(cfg->workers, sizeof(cfg->workers), "%s", value);
+            } else if(strcmp(key, "watch_backend") == 0) {
+                if(strcmp(value, "auto") != 0 && strcmp(value, "inotify") != 0 && strcmp(value, "poll") != 0) {
+                    fprintf(stderr, "Error: Unknown watch_backend '%s' (use auto, inotify or poll)\n", value);
+                    fclose(f);
+                    return 0;
+                }
+                snprintf(cfg->watch_backend, sizeof(cfg->watch_backend), "%s", value);
+            } else if(strcmp(key, "watch_debounce_ms") == 0) {
+                char *end;
+                cfg->watch_debounce_ms = (int)strtol(value, &end, 10);
+                if(end == value || *end || cfg->watch_debounce_ms < 0) {
+                    fprintf(stderr, "Error: Invalid watch_debounce_ms '%s' (milliseconds, 0 to disable)\n", value);
+                    fclose(f);
+                    return 0;
+                }
+            } else if(strcmp(key, "run_stop_timeout_ms") == 0) {
+                char *end;
+                cfg->run_stop_timeout_ms = (int)strtol(value, &end, 10);
+                if(end == value || *end || cfg->run_stop_timeout_ms < 0) {
+                    fprintf(stderr, "Error: Invalid run_stop_timeout_ms '%s' (milliseconds)\n", value);
+                    fclose(f);
+                    return 0;
+                }
+            } else if(strcmp(key, "debug_split") == 0) {
+                cfg->debug_split = strcmp(value, "on") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+            } else if(strcmp(key, "linker") == 0) {
+                if(!valid_linker(value)) {
+                    fprintf(stderr, "Error: Unknown linker '%s' (use mold, lld, gold, bfd or auto)\n", value);
+                    fclose(f);
+                    return 0;
+                }
+                snprintf(cfg->linker, sizeof(cfg->linker), "%s", value);
+            } else if(strcmp(key, "unity_batch") == 0) {
+                cfg->unity_batch = atoi(value);
+                if(cfg->unity_batch < 1) {
+                    fprintf(stderr, "Error: Invalid unity_batch '%s' (must be at least 1)\n", value);
+                    fclose(f);
+                    return 0;
+                }
+            } else if(strcmp(key, "optimize") == 0) {
+                cfg->optimize = parse_optimize(value);
+                if(cfg->optimize < 0) {
+                    fclose(f);
+                    return 0;
+                }
+            } else if(strcmp(key, "variant") == 0) {
+                snprintf(cfg->default_variants, sizeof(cfg->default_variants), "%s", value);
+            } else if(strcmp(key, "train_cmd") == 0) {
+                snprintf(cfg->train_cmd, sizeof(cfg->train_cmd), "%s", value);
+            } else if(strcmp(key, "cache_dir") == 0) {
+                snprintf(cfg->cache_dir, sizeof(cfg->cache_dir), "%s", value);
+            } else if(strcmp(key, "cache_size") == 0) {
+                cfg->cache_size = parse_size(value);
+                if(cfg->cache_size <= 0) {
+                    fprintf(stderr, "Error: Invalid cache_size '%s' (e.g. 500M, 5G)\n", value);
+                    fclose(f);
+                    return 0;
+                }
             }
         }
     }
 
     fclose(f);
+    resolve_linker(cfg);
 
-    /* if no targets defined but old-style config exists, create a single target for backward compatibility */
-    if(cfg->target_count == 0 && strlen(cfg->target_name) > 0) {
-        Target *compat_target = &cfg->targets[0];
+    /* if no executable targets defined but old-style config exists, create a single target for backward compatibility */
+    int executable_count = 0;
+    for(int t = 0; t < cfg->target_count; t++) {
+        if(cfg->targets[t].kind == TARGET_EXECUTABLE) executable_count++;
+    }
+    if(executable_count == 0 && strlen(cfg->target_name) > 0 && cfg->target_count < MAX_TARGETS) {
+        Target *compat_target = &cfg->targets[cfg->target_count];
         strcpy(compat_target->name, cfg->target_name);
+        compat_target->kind = TARGET_EXECUTABLE;
         for(int i = 0; i < cfg->source_count; i++) {
             strcpy(compat_target->sources[i], cfg->sources[i]);
         }
@@ -120,8 +279,29 @@ int parse_buildfile(const char *filename, BuildConfig *cfg) {
             strcpy(compat_target->ldflags[i], cfg->ldflags[i]);
         }
         compat_target->ldflag_count = cfg->ldflag_count;
-        cfg->target_count = 1;
+        for(int i = 0; i < cfg->link_count; i++) {
+            strcpy(compat_target->links[i], cfg->links[i]);
+        }
+        compat_target->link_count = cfg->link_count;
+        cfg->target_count++;
+    }
+
+    /* links must name a library defined somewhere in the file */
+    for(int t = 0; t < cfg->target_count; t++) {
+        Target *target = &cfg->targets[t];
+        for(int i = 0; i < target->link_count; i++) {
+            int dep = find_target(cfg, target->links[i]);
+            if(dep < 0 || cfg->targets[dep].kind == TARGET_EXECUTABLE || dep == t) {
+                fprintf(stderr, "Error: Target %s links unknown library '%s'\n", target->name, target->links[i]);
+                return 0;
+            }
+        }
     }
 
     return 1;
-}
\ No newline at end of file
+}
+/* -j and -G from the command line override build.conf */
+void apply_command_line(BuildConfig *cfg) {
+    if(cfg->cli_jobs > 0) cfg->jobs = cfg->cli_jobs;
+    if(cfg->cli_generator[0]) snprintf(cfg->generator, sizeof(cfg->generator), "%s", cfg->cli_generator);
+}
@@ -0,0 +1,386 @@
+#include "anvil.h"
+#include "colors.h"
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * `anvil --daemon`: keeps the parsed config, the dependency graph and a
+ * table of file states in memory and serves build requests on
+ * <build dir>/anvil.sock. A request whose tracked files (build.conf,
+ * sources, headers from the depfiles and the include directories, their
+ * directories and the outputs) all still have the stat data of the last
+ * successful build is answered without touching the build at all.
+ * `anvil client` is the matching thin client.
+ *
+ * Requests are one line (build, status or stop); the reply is the
+ * command's output followed by a NUL byte and the exit status.
+ */
+
+typedef struct {
+    const char *config_file;
+    int jobs;               /* command line overrides, reapplied on reload */
+    const char *generator;
+    const char *variant;
+
+    BuildConfig *cfg;
+    BuildGraph *graph;
+    WatchSet files;         /* stat data as of the last build; an mtime of -1 forces a rebuild */
+    int clean;              /* the table reflects a successful build */
+    int64_t build_start;    /* inputs edited after this must not look built */
+    int builds;
+    int skipped;
+} Daemon;
+
+static char socket_path[256];
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void track(Daemon *d, const char *path, int input) {
+    int known = d->files.count;
+    int i = watch_set_add(&d->files, path);
+    if(i < known) return;
+    /* saved while the build ran: record it as changed so the next request builds again */
+    if(input && d->files.mtimes[i] >= d->build_start) d->files.mtimes[i] = -1;
+}
+
+/* whether file i's stat data moved since the snapshot, which is left as it was; st is zeroed when it is gone */
+static int file_moved(Daemon *d, int i, struct stat *st) {
+    WatchSet *files = &d->files;
+    if(stat(watch_set_path(files, i), st) != 0) {
+        memset(st, 0, sizeof(*st));
+        return files->sizes[i] != -1;
+    }
+    int64_t mtime = (int64_t)st->st_mtim.tv_sec * 1000000000LL + st->st_mtim.tv_nsec;
+    return mtime != files->mtimes[i] || st->st_size != files->sizes[i] || st->st_ino != files->inodes[i];
+}
+
+/* a directory's mtime moves when files are added or removed, which may change a glob */
+static void track_parent(Daemon *d, const char *path) {
+    char dir[256];
+    snprintf(dir, sizeof(dir), "%s", path);
+    char *slash = strrchr(dir, '/');
+    if(slash) {
+        *slash = 0;
+    } else {
+        strcpy(dir, ".");
+    }
+    track(d, dir, 1);
+}
+
+static int track_dependency(const char *dep, void *ctx) {
+    Daemon *d = ctx;
+    /* system headers change with package upgrades, not edits */
+    if(dep[0] == '/') return 1;
+    char full[512];
+    root_path(d->cfg, dep, full, sizeof(full));
+    track(d, full, 1);
+    return 1;
+}
+
+/* rebuild the file table from the config, the include directories and the depfiles */
+static void snapshot_files(Daemon *d) {
+    BuildConfig *cfg = d->cfg;
+    BuildGraph *graph = d->graph;
+    watch_set_clear(&d->files);
+
+    track(d, d->config_file, 1);
+    for(int t = 0; t < cfg->target_count; t++) {
+        for(int i = 0; i < cfg->targets[t].source_count; i++) {
+            track(d, cfg->targets[t].sources[i], 1);
+            track_parent(d, cfg->targets[t].sources[i]);
+        }
+        char output[256], full[400];
+        target_output_path(cfg, &cfg->targets[t], output, sizeof(output));
+        snprintf(full, sizeof(full), "%s/%s", cfg->build_dir, output);
+        track(d, full, 0);
+    }
+    for(int i = 0; i < graph->object_count; i++) {
+        char full[400];
+        snprintf(full, sizeof(full), "%s/obj/%s", cfg->build_dir, graph->objects[i].object);
+        track(d, full, 0);
+    }
+    if(cfg->pch[0]) track(d, cfg->pch, 1);
+
+    WatchSet headers = {0};
+    for(int i = 0; i < cfg->include_count; i++) {
+        track(d, cfg->includes[i], 1);
+        scan_directory_for_headers(cfg->includes[i], &headers);
+    }
+    for(int i = 0; i < headers.count; i++) {
+        track(d, watch_set_path(&headers, i), 1);
+        track_parent(d, watch_set_path(&headers, i));
+    }
+    watch_set_free(&headers);
+
+    for(int i = 0; i < graph->object_count; i++) {
+        char output[256];
+        snprintf(output, sizeof(output), "obj/%s", graph->objects[i].object);
+        for_each_dependency(cfg, output, track_dependency, d);
+    }
+}
+
+/* the first tracked file whose stat data moved, or NULL */
+static const char *changed_file(Daemon *d) {
+    struct stat st;
+    for(int i = 0; i < d->files.count; i++) {
+        if(file_moved(d, i, &st)) return watch_set_path(&d->files, i);
+    }
+    return NULL;
+}
+
+/* 1 if any moved entry is build.conf or a directory, either of which can change globs and flags */
+static int layout_changed(Daemon *d) {
+    struct stat st;
+    for(int i = 0; i < d->files.count; i++) {
+        if(!file_moved(d, i, &st)) continue;
+        if(strcmp(watch_set_path(&d->files, i), d->config_file) == 0 || S_ISDIR(st.st_mode)) return 1;
+    }
+    return 0;
+}
+
+static int load_config(Daemon *d) {
+    BuildConfig *cfg = malloc(sizeof(BuildConfig));
+    if(!cfg) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 0;
+    }
+    if(!parse_buildfile(d->config_file, cfg)) {
+        free(cfg);
+        return 0;
+    }
+
+    /* one daemon serves one build directory, so at most one variant */
+    char names[MAX_VARIANTS][64];
+    int count = select_variants(cfg, d->variant ? d->variant : cfg->default_variants, names, MAX_VARIANTS);
+    if(count > 1) fprintf(stderr, "Error: The daemon serves a single variant\n");
+    if(count < 0 || count > 1 || (count == 1 && !apply_variant(cfg, names[0]))) {
+        free(cfg);
+        return 0;
+    }
+    if(d->jobs > 0) cfg->jobs = d->jobs;
+    if(d->generator) snprintf(cfg->generator, sizeof(cfg->generator), "%s", d->generator);
+    cfg->use_executor = 1;
+
+    BuildGraph *graph = NULL;
+    if(!create_directory_recursive(cfg->build_dir) || !generate_build_files(cfg) || !(graph = build_graph_create(cfg))) {
+        free(cfg);
+        return 0;
+    }
+
+    if(d->graph) build_graph_free(d->graph);
+    free(d->cfg);
+    d->cfg = cfg;
+    d->graph = graph;
+    return 1;
+}
+
+static int handle_build(Daemon *d) {
+    const char *changed = d->clean ? changed_file(d) : d->config_file;
+    if(!changed) {
+        d->skipped++;
+        printf(DIM "Everything is up to date" RESET "\n");
+        return 0;
+    }
+
+    /* build.conf or a directory changed: parse again so globs and flags are current */
+    int reload = !d->clean || layout_changed(d);
+    if(reload && d->builds > 0 && !load_config(d)) return 1;
+
+    d->builds++;
+    d->clean = 0;
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    d->build_start = (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+    int ok = execute_graph(d->cfg, d->graph, d->cfg->jobs);
+    snapshot_files(d);
+    d->clean = ok;
+    return ok ? 0 : 1;
+}
+
+static void handle_status(Daemon *d) {
+    printf("Project: %s\n", d->cfg->project_name);
+    printf("Build directory: %s\n", d->cfg->build_dir);
+    printf("Tracked files: %d\n", d->files.count);
+    printf("Builds: %d, answered from memory: %d\n", d->builds, d->skipped);
+    const char *changed = d->clean ? changed_file(d) : NULL;
+    if(!d->clean) {
+        printf("State: needs a build\n");
+    } else if(changed) {
+        printf("State: %s changed\n", changed);
+    } else {
+        printf("State: up to date\n");
+    }
+}
+
+/* run one request with stdout and stderr pointed at the client */
+static int serve_request(Daemon *d, int client) {
+    char request[64] = "";
+    size_t len = 0;
+    while(len + 1 < sizeof(request)) {
+        ssize_t n = read(client, request + len, 1);
+        if(n <= 0 || request[len] == '\n') break;
+        len++;
+    }
+    request[len] = 0;
+
+    fflush(stdout);
+    fflush(stderr);
+    int saved_out = dup(STDOUT_FILENO), saved_err = dup(STDERR_FILENO);
+    dup2(client, STDOUT_FILENO);
+    dup2(client, STDERR_FILENO);
+
+    int status = 0, stop = 0;
+    if(strcmp(request, "build") == 0) {
+        status = handle_build(d);
+    } else if(strcmp(request, "status") == 0) {
+        handle_status(d);
+    } else if(strcmp(request, "stop") == 0) {
+        printf("Daemon stopping\n");
+        stop = 1;
+    } else {
+        fprintf(stderr, "Error: Unknown request '%s' (use build, status or stop)\n", request);
+        status = 1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+    dup2(saved_out, STDOUT_FILENO);
+    dup2(saved_err, STDERR_FILENO);
+    close(saved_out);
+    close(saved_err);
+
+    char trailer[16];
+    int n = snprintf(trailer, sizeof(trailer), "%c%d\n", 0, status);
+    if(write(client, trailer, n) != n) {
+        /* the client went away; nothing left to tell it */
+    }
+    return stop;
+}
+
+static int daemon_socket(const char *path) {
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Error: Socket path too long: %s\n", path);
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0) return -1;
+
+    /* a socket nobody answers on is left over from a daemon that died */
+    if(connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "Error: A daemon is already serving %s\n", path);
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    unlink(path);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        fprintf(stderr, "Error: Cannot listen on %s: %s\n", path, strerror(errno));
+        if(fd >= 0) close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int daemon_mode(const char *config_file, int jobs, const char *generator, const char *variant) {
+    Daemon d = {0};
+    d.config_file = config_file;
+    d.jobs = jobs;
+    d.generator = generator;
+    d.variant = variant;
+    if(!load_config(&d)) return 1;
+
+    snprintf(socket_path, sizeof(socket_path), "%s/anvil.sock", d.cfg->build_dir);
+    int fd = daemon_socket(socket_path);
+    if(fd < 0) return 1;
+
+    struct sigaction sa = {0};
+    sa.sa_handler = handle_stop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf(BRIGHT_CYAN "Anvil daemon serving %s" RESET "\n", socket_path);
+    printf(DIM "Request builds with: anvil client build" RESET "\n");
+    fflush(stdout);
+
+    int stop = 0;
+    while(!stop && !stop_requested) {
+        int client = accept(fd, NULL, NULL);
+        if(client < 0) {
+            if(errno == EINTR) continue;
+            fprintf(stderr, "Error: accept failed: %s\n", strerror(errno));
+            break;
+        }
+        stop = serve_request(&d, client);
+        close(client);
+    }
+
+    close(fd);
+    unlink(socket_path);
+    if(d.graph) build_graph_free(d.graph);
+    free(d.cfg);
+    watch_set_free(&d.files);
+    return 0;
+}
+
+/* `anvil client [build|status|stop] [--socket path]`: forwards one request and relays the reply */
+int daemon_client(int argc, char *argv[]) {
+    const char *request = "build";
+    const char *path = "build/anvil.sock";
+    for(int i = 0; i < argc; i++) {
+        if(strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            path = argv[++i];
+        } else {
+            request = argv[i];
+        }
+    }
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Error: No daemon on %s (start one with: anvil --daemon build.conf)\n", path);
+        if(fd >= 0) close(fd);
+        return 1;
+    }
+
+    char line[80];
+    int n = snprintf(line, sizeof(line), "%s\n", request);
+    if(write(fd, line, n) != n) {
+        close(fd);
+        return 1;
+    }
+
+    /* everything up to the NUL is output; the exit status follows it */
+    char buf[4096], status_text[16] = "";
+    int in_status = 0;
+    size_t status_len = 0;
+    ssize_t got;
+    while((got = read(fd, buf, sizeof(buf))) > 0) {
+        for(ssize_t i = 0; i < got; i++) {
+            if(in_status) {
+                if(status_len + 1 < sizeof(status_text)) status_text[status_len++] = buf[i];
+            } else if(buf[i] == 0) {
+                fwrite(buf, 1, i, stdout);
+                in_status = 1;
+            }
+        }
+        if(!in_status) fwrite(buf, 1, got, stdout);
+    }
+    close(fd);
+    fflush(stdout);
+    status_text[status_len] = 0;
+    return in_status ? atoi(status_text) : 1;
+}
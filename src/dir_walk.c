@@ -0,0 +1,133 @@
+#define _GNU_SOURCE
+#include "anvil.h"
+#include <fcntl.h>
+#include <limits.h>
+
+/*
+ * Directory walker shared by glob expansion and the header and watch-mode
+ * scans. Each directory is opened relative to its parent's fd, so the
+ * kernel never resolves a full path again, and the entry type comes from
+ * d_type. Only entries the filesystem leaves untyped (and symlinks, which
+ * are followed like stat() would) cost an fstatat. On Linux the entries
+ * are read in batches with getdents64.
+ *
+ * Names starting with a dot are skipped, as every caller did before.
+ */
+
+#define WALK_MAX_DEPTH 64
+
+typedef struct {
+    DirWalkVisit visit;
+    void *ctx;
+    char path[PATH_MAX];
+    int stopped;
+} Walk;
+
+/* 1 for a directory, 0 for anything else, -1 when it cannot be told */
+static int entry_is_dir(int dirfd, const char *name, unsigned char type) {
+    if(type == DT_DIR) return 1;
+    if(type != DT_UNKNOWN && type != DT_LNK) return 0;
+    struct stat st;
+    if(fstatat(dirfd, name, &st, 0) != 0) return -1;
+    return S_ISDIR(st.st_mode);
+}
+
+static void walk_fd(Walk *walk, int dirfd, size_t len, int recursive, int depth);
+
+/* one entry: report it and, when asked to, descend */
+static void walk_entry(Walk *walk, int dirfd, size_t len, const char *name, unsigned char type, int recursive, int depth) {
+    if(name[0] == '.') return;
+    int is_dir = entry_is_dir(dirfd, name, type);
+    if(is_dir < 0) return;
+
+    size_t name_len = strlen(name);
+    size_t start = strcmp(walk->path, ".") == 0 ? 0 : walk->path[len - 1] == '/' ? len : len + 1;
+    if(start + name_len >= sizeof(walk->path)) return;
+    if(start > len) walk->path[len] = '/';
+    memcpy(walk->path + start, name, name_len + 1);
+
+    DirEntry entry = { walk->path, walk->path + start, is_dir };
+    int result = walk->visit(&entry, walk->ctx);
+    if(result < 0) {
+        walk->stopped = 1;
+    } else if(result > 0 && is_dir && recursive && depth < WALK_MAX_DEPTH) {
+        int fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if(fd >= 0) {
+            walk_fd(walk, fd, start + name_len, recursive, depth + 1);
+            close(fd);
+        }
+    }
+
+    /* back to this directory's path for the next entry */
+    if(start) walk->path[len] = 0;
+    else strcpy(walk->path, ".");
+}
+
+#ifdef __linux__
+#include <sys/syscall.h>
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static void walk_fd(Walk *walk, int dirfd, size_t len, int recursive, int depth) {
+    char buf[8192] __attribute__((aligned(8)));
+    long n;
+    while(!walk->stopped && (n = syscall(SYS_getdents64, dirfd, buf, sizeof(buf))) > 0) {
+        for(long pos = 0; pos < n && !walk->stopped;) {
+            struct linux_dirent64 *d = (struct linux_dirent64 *)(buf + pos);
+            walk_entry(walk, dirfd, len, d->d_name, d->d_type, recursive, depth);
+            pos += d->d_reclen;
+        }
+    }
+}
+
+#else
+
+static void walk_fd(Walk *walk, int dirfd, size_t len, int recursive, int depth) {
+    /* fdopendir takes the fd over, so give it a copy the caller can still close */
+    int fd = dup(dirfd);
+    DIR *d = fd >= 0 ? fdopendir(fd) : NULL;
+    if(!d) {
+        if(fd >= 0) close(fd);
+        return;
+    }
+    struct dirent *entry;
+    while(!walk->stopped && (entry = readdir(d)) != NULL)
+        walk_entry(walk, dirfd, len, entry->d_name, entry->d_type, recursive, depth);
+    closedir(d);
+}
+
+#endif
+
+/*
+ * Report every entry under root to visit, which returns 1 to descend into
+ * a directory (with recursive set), 0 to go on, or -1 to stop the walk.
+ * Entry paths are root joined with the relative path ("." is left out)
+ * and are only valid during the call. Returns 0 when root cannot be opened.
+ */
+int walk_directory(const char *root, int recursive, DirWalkVisit visit, void *ctx) {
+    int fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(fd < 0) return 0;
+
+    Walk *walk = malloc(sizeof(Walk));
+    if(!walk) {
+        close(fd);
+        return 0;
+    }
+    walk->visit = visit;
+    walk->ctx = ctx;
+    walk->stopped = 0;
+    snprintf(walk->path, sizeof(walk->path), "%s", root);
+    size_t len = strlen(walk->path);
+    while(len > 1 && walk->path[len - 1] == '/') walk->path[--len] = 0;
+
+    walk_fd(walk, fd, len, recursive, 0);
+    close(fd);
+    free(walk);
+    return 1;
+}
@@ -0,0 +1,178 @@
+#include "anvil.h"
+
+/*
+ * Event-driven watch backend. The directories holding watched files are
+ * registered with inotify, so watch mode sleeps in poll() until something
+ * is written, renamed or removed there. Directories rather than files are
+ * watched because editors often save by writing a new file and renaming
+ * it over the old one. Where inotify is missing (non-Linux builds, some
+ * network filesystems, an exhausted max_user_watches) watch mode falls
+ * back to stat polling, and the same directory list is then polled for
+ * entries that appear or disappear.
+ */
+
+/* add a path to a batch once; 0 when the batch is full */
+static int add_path(char paths[][256], int *count, int max, const char *path) {
+    for(int i = 0; i < *count; i++) {
+        if(strcmp(paths[i], path) == 0) return 1;
+    }
+    if(*count >= max) return 0;
+    strcpy(paths[(*count)++], path);
+    return 1;
+}
+
+typedef struct {
+    char (*paths)[256];
+    int *count;
+    int max;
+    int overflow;
+} PollBatch;
+
+static int add_entry(const DirEntry *entry, void *ctx) {
+    PollBatch *batch = ctx;
+    if(strlen(entry->path) >= sizeof(batch->paths[0])) {
+        fprintf(stderr, "Warning: Path too long to watch, ignoring %s\n", entry->path);
+        return 0;
+    }
+    if(!add_path(batch->paths, batch->count, batch->max, entry->path)) batch->overflow = 1;
+    return 0;
+}
+
+/*
+ * Polling counterpart of dir_watch_wait: every entry of a directory whose
+ * stat data moved (mtime to the nanosecond, so two changes within a second
+ * are told apart), so added and removed files are seen. Returns the count, or
+ * -2 when there were more than max.
+ */
+int dir_watch_poll(DirWatch *w, char paths[][256], int max) {
+    int count = 0;
+    PollBatch batch = { paths, &count, max, 0 };
+    for(int i = 0; i < w->dirs.count; i++) {
+        if(!watch_set_stat(&w->dirs, i)) continue;
+        walk_directory(watch_set_path(&w->dirs, i), 0, add_entry, &batch);
+    }
+    return batch.overflow ? -2 : count;
+}
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+
+#define DIR_WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE | IN_ATTRIB)
+
+/* dir/name in out; 0 when that does not fit, which is reported and the event skipped */
+static int entry_path(const char *dir, const char *name, char *out, size_t size) {
+    int len = strcmp(dir, ".") == 0 ? snprintf(out, size, "%s", name) : snprintf(out, size, "%s/%s", dir, name);
+    if(len >= 0 && (size_t)len < size) return 1;
+    fprintf(stderr, "Warning: Path too long to watch, ignoring %s/%s\n", dir, name);
+    return 0;
+}
+
+/* remember which directory a watch descriptor belongs to; 0 when out of memory */
+static int map_wd(DirWatch *w, int wd, int slot) {
+    if(wd >= w->wd_capacity) {
+        int capacity = w->wd_capacity ? w->wd_capacity : 256;
+        while(capacity <= wd) capacity *= 2;
+        int *wd_slots = realloc(w->wd_slots, capacity * sizeof(int));
+        if(!wd_slots) return 0;
+        memset(wd_slots + w->wd_capacity, 0, (capacity - w->wd_capacity) * sizeof(int));
+        w->wd_slots = wd_slots;
+        w->wd_capacity = capacity;
+    }
+    w->wd_slots[wd] = slot + 1;
+    return 1;
+}
+
+int dir_watch_open(DirWatch *w, int use_inotify) {
+    watch_set_clear(&w->dirs);
+    if(w->wd_slots) memset(w->wd_slots, 0, w->wd_capacity * sizeof(int));
+    w->wake_fd = -1;
+    w->fd = use_inotify ? inotify_init1(IN_NONBLOCK | IN_CLOEXEC) : -1;
+    return w->fd >= 0;
+}
+
+/* 0 when inotify cannot take the directory; it is then closed and the list is polled instead */
+int dir_watch_add(DirWatch *w, const char *dir) {
+    if(watch_set_find(&w->dirs, dir) >= 0) return 1;
+    int slot = watch_set_add(&w->dirs, dir);
+    if(slot < 0 && w->fd < 0) return 1;
+
+    int wd = -1;
+    if(slot < 0 || (w->fd >= 0 && (wd = inotify_add_watch(w->fd, dir, DIR_WATCH_EVENTS)) < 0) ||
+       (wd >= 0 && !map_wd(w, wd, slot))) {
+        dir_watch_close(w);
+        return 0;
+    }
+    return 1;
+}
+
+static const char *watch_dir_of(DirWatch *w, int wd) {
+    if(wd < 0 || wd >= w->wd_capacity || !w->wd_slots[wd]) return NULL;
+    return watch_set_path(&w->dirs, w->wd_slots[wd] - 1);
+}
+
+/*
+ * Block for up to timeout_ms (-1 = forever) and collect the paths of the
+ * entries that changed. Returns their count, 0 on timeout, -1 when the
+ * backend failed, or -2 when events were lost and everything must be
+ * rechecked.
+ */
+int dir_watch_wait(DirWatch *w, int timeout_ms, char paths[][256], int max) {
+    struct pollfd pfd[2] = { { .fd = w->fd, .events = POLLIN }, { .fd = w->wake_fd, .events = POLLIN } };
+    int ready = poll(pfd, w->wake_fd >= 0 ? 2 : 1, timeout_ms);
+    if(ready < 0) return errno == EINTR ? 0 : -1;
+    if(!(pfd[0].revents & POLLIN)) return 0;
+
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    int count = 0, overflow = 0;
+    ssize_t len;
+    while((len = read(w->fd, buf, sizeof(buf))) > 0) {
+        for(char *p = buf; p < buf + len; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len) {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            if(ev->mask & IN_Q_OVERFLOW) overflow = 1;
+            if(!ev->len) continue;
+
+            const char *dir = watch_dir_of(w, ev->wd);
+            if(!dir) continue;
+
+            char path[256];
+            if(!entry_path(dir, ev->name, path, sizeof(path))) continue;
+            if(!add_path(paths, &count, max, path)) overflow = 1;
+        }
+    }
+    if(len < 0 && errno != EAGAIN) return -1;
+
+    return overflow ? -2 : count;
+}
+
+/* stop inotify; the directory list stays for polling */
+void dir_watch_close(DirWatch *w) {
+    if(w->fd >= 0) close(w->fd);
+    w->fd = -1;
+}
+
+#else
+
+int dir_watch_open(DirWatch *w, int use_inotify) {
+    (void)use_inotify;
+    w->fd = -1;
+    w->wake_fd = -1;
+    watch_set_clear(&w->dirs);
+    return 0;
+}
+
+int dir_watch_add(DirWatch *w, const char *dir) {
+    watch_set_add(&w->dirs, dir);
+    return 1;
+}
+
+int dir_watch_wait(DirWatch *w, int timeout_ms, char paths[][256], int max) {
+    (void)w; (void)timeout_ms; (void)paths; (void)max;
+    return -1;
+}
+
+void dir_watch_close(DirWatch *w) {
+    w->fd = -1;
+}
+
+#endif
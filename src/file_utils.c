@@ -18,8 +18,22 @@ time_t get_mtime(const char *path) {
     return 0;
 }
 
+typedef struct {
+    char (*dest)[128];
+    int *count;
+    int max;
+} GlobMatch;
+
+static int add_glob_match(const DirEntry *entry, void *ctx) {
+    GlobMatch *match = ctx;
+    if(*match->count >= match->max) return -1;
+    if(entry->is_dir || !is_c_file(entry->name) || strlen(entry->path) >= sizeof(match->dest[0])) return 0;
+    strcpy(match->dest[(*match->count)++], entry->path);
+    return 0;
+}
+
 void expand_glob(const char *pattern, char dest[][128], int *count, int max) {
-    char path[256], wildcard[128];
+    char path[256];
     strcpy(path, pattern);
 
     char *star = strchr(path, '*');
@@ -32,39 +46,23 @@ void expand_glob(const char *pattern, char dest[][128], int *count, int max) {
         return;
     }
 
+    int64_t start_us = trace_now_us();
     char *last_slash = strrchr(path, '/');
     if(last_slash) {
         *last_slash = 0;
-        strcpy(wildcard, last_slash + 1);
     } else {
         strcpy(path, ".");
-        strcpy(wildcard, pattern);
     }
 
-    DIR *dir = opendir(path);
-    if(!dir) {
+    GlobMatch match = { dest, count, max };
+    if(!walk_directory(path, 0, add_glob_match, &match)) {
         fprintf(stderr, "Warning: Cannot open directory %s\n", path);
         return;
     }
 
-    struct dirent *entry;
-    while((entry = readdir(dir)) != NULL && *count < max) {
-        if(entry->d_name[0] == '.') continue;
-
-        if(!is_c_file(entry->d_name)) continue;
-
-        char fullpath[256];
-        if(strcmp(path, ".") == 0) {
-            snprintf(fullpath, sizeof(fullpath), "%s", entry->d_name);
-        } else {
-            snprintf(fullpath, sizeof(fullpath), "%s/%s", path, entry->d_name);
-        }
-
-        strcpy(dest[*count], fullpath);
-        (*count)++;
-    }
-
-    closedir(dir);
+    char phase[160];
+    snprintf(phase, sizeof(phase), "expand_glob %s", pattern);
+    trace_span("phase", phase, 0, start_us);
 }
 
 int create_directory(const char *path) {
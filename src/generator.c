@@ -0,0 +1,154 @@
+#include "anvil.h"
+#include "colors.h"
+#include "version.h"
+
+/* every backend writes its build file into the config's build directory from the same BuildConfig */
+static const Generator generators[] = {
+    { "make",  "Makefile",    "cd %s && make 2>&1",     "cd %s && make %s 2>&1",  generate_makefile },
+    { "ninja", "build.ninja", "cd %s && ninja 2>&1",    "cd %s && ninja %s 2>&1", generate_ninja },
+};
+
+const Generator *find_generator(const char *name) {
+    for(size_t i = 0; i < sizeof(generators) / sizeof(generators[0]); i++) {
+        if(strcmp(generators[i].name, name) == 0) return &generators[i];
+    }
+    return NULL;
+}
+
+const Generator *config_generator(BuildConfig *cfg) {
+    const Generator *gen = find_generator(cfg->generator[0] ? cfg->generator : "make");
+    return gen ? gen : &generators[0];
+}
+
+static uint64_t hash_text(const char *text, uint64_t h) {
+    return hash_bytes(text, strlen(text) + 1, h);
+}
+
+static uint64_t hash_int(int value, uint64_t h) {
+    return hash_bytes(&value, sizeof(value), h);
+}
+
+static uint64_t hash_list(const char (*items)[128], int count, uint64_t h) {
+    h = hash_int(count, h);
+    for(int i = 0; i < count; i++) h = hash_text(items[i], h);
+    return h;
+}
+
+/*
+ * Everything the generated file depends on, field by field: the settings
+ * the generators read, the flag strings as resolved (the probed linker, the
+ * PGO stage), the graph of objects with unity batches and watch-mode
+ * exclusions applied, the backend, the anvil version that writes it and the
+ * checkout it lives in. Creating the graph also rewrites any unity batch
+ * file that has gone missing. Returns 0 when the graph cannot be built.
+ */
+static int config_fingerprint(BuildConfig *cfg, const Generator *gen, uint64_t *fingerprint) {
+    BuildGraph *graph = build_graph_create(cfg);
+    if(!graph) return 0;
+
+    uint64_t h = hash_text(cfg->project_name, 0);
+    h = hash_text(cfg->version, h);
+    h = hash_text(cfg->output_dir, h);
+    h = hash_text(cfg->build_dir, h);
+    h = hash_text(cfg->source_root, h);
+    h = hash_list(cfg->includes, cfg->include_count, h);
+    h = hash_list(cfg->cflags, cfg->cflag_count, h);
+    h = hash_list(cfg->ldflags, cfg->ldflag_count, h);
+
+    char flags[1024];
+    optimize_flags(cfg, flags, sizeof(flags));
+    h = hash_text(flags, h);
+    debug_flags(cfg, flags, sizeof(flags));
+    h = hash_text(flags, h);
+    link_flags(cfg, flags, sizeof(flags));
+    h = hash_text(flags, h);
+    /* ninja sizes its pools from it */
+    h = hash_int(cfg->jobs > 0 ? cfg->jobs : default_job_count(), h);
+
+    for(int t = 0; t < cfg->target_count; t++) {
+        Target *target = &cfg->targets[t];
+        h = hash_text(target->name, h);
+        h = hash_int(target->kind, h);
+        h = hash_list(target->ldflags, target->ldflag_count, h);
+        h = hash_int(graph->target_flagset[t], h);
+        h = hash_bytes(graph->target_objects[t], graph->target_object_count[t] * sizeof(int), h);
+        h = hash_bytes(graph->target_links[t], graph->target_link_count[t] * sizeof(int), h);
+    }
+    for(int i = 0; i < graph->flagset_count; i++) {
+        h = hash_text(graph->flagsets[i].flags, h);
+        h = hash_text(graph->flagsets[i].pch, h);
+        h = hash_text(graph->flagsets[i].name, h);
+    }
+    for(int i = 0; i < graph->object_count; i++) {
+        h = hash_text(graph->objects[i].source, h);
+        h = hash_text(graph->objects[i].object, h);
+        h = hash_int(graph->objects[i].flagset, h);
+    }
+    build_graph_free(graph);
+
+    char root[512];
+    if(!getcwd(root, sizeof(root))) root[0] = 0;
+    h = hash_text(root, h);
+    h = hash_text(gen->name, h);
+    *fingerprint = hash_text(ANVIL_VERSION_STRING, h);
+    return 1;
+}
+
+static int fingerprint_matches(const char *stamp, uint64_t fingerprint) {
+    FILE *f = fopen(stamp, "r");
+    if(!f) return 0;
+    unsigned long long stored = 0;
+    int ok = fscanf(f, "%llx", &stored) == 1 && stored == fingerprint;
+    fclose(f);
+    return ok;
+}
+
+int generate_build_files(BuildConfig *cfg) {
+    const Generator *gen = find_generator(cfg->generator[0] ? cfg->generator : "make");
+    if(!gen) {
+        fprintf(stderr, "Error: Unknown generator '%s' (available:", cfg->generator);
+        for(size_t i = 0; i < sizeof(generators) / sizeof(generators[0]); i++)
+            fprintf(stderr, " %s", generators[i].name);
+        fprintf(stderr, ")\n");
+        return 0;
+    }
+
+    char path[256], tmp[300], stamp[256];
+    snprintf(path, sizeof(path), "%s/%s", cfg->build_dir, gen->output);
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    snprintf(stamp, sizeof(stamp), "%s/.anvil_config", cfg->build_dir);
+
+    /* an untouched build file keeps its mtime, so make has nothing to re-evaluate */
+    uint64_t fingerprint;
+    if(!config_fingerprint(cfg, gen, &fingerprint)) return 0;
+    if(access(path, F_OK) == 0 && fingerprint_matches(stamp, fingerprint)) {
+        printf(DIM "%s is up to date" RESET "\n", path);
+        return 1;
+    }
+
+    /* write beside the old file and rename over it, so a build never reads half of one */
+    FILE *f = fopen(tmp, "w");
+    if(!f) {
+        fprintf(stderr, "Error: Cannot create %s\n", tmp);
+        return 0;
+    }
+    char phase[64];
+    snprintf(phase, sizeof(phase), "generate %s", gen->output);
+    int64_t start_us = trace_now_us();
+    int ok = gen->generate(cfg, f);
+    trace_span("phase", phase, 0, start_us);
+    if(fclose(f) != 0) ok = 0;
+    if(!ok || rename(tmp, path) != 0) {
+        if(ok) fprintf(stderr, "Error: Cannot replace %s\n", path);
+        unlink(tmp);
+        return 0;
+    }
+
+    f = fopen(stamp, "w");
+    if(f) {
+        fprintf(f, "%016llx %s\n", (unsigned long long)fingerprint, gen->name);
+        fclose(f);
+    }
+    printf(BRIGHT_GREEN "Generated %s successfully!" RESET "\n", path);
+    return 1;
+}
@@ -0,0 +1,304 @@
+#include "anvil.h"
+
+/*
+ * Persistent content-hash database (build/.anvil_hashes).
+ *
+ * Each entry remembers a file's size, nanosecond mtime and XXH64 content
+ * hash, so a file is only re-read when its stat data moved. Outputs also
+ * carry the signature of the inputs they were last built from, which lets
+ * the executor skip compiles and relinks whose inputs are byte-identical.
+ */
+
+#define HASH_DB_HEADER "# anvil hash db v1"
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+static uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/* XXH64 */
+uint64_t hash_bytes(const void *data, size_t len, uint64_t seed) {
+    const unsigned char *p = data;
+    const unsigned char *end = p + len;
+    uint64_t h;
+
+    if(len >= 32) {
+        uint64_t v1 = seed + PRIME64_1 + PRIME64_2;
+        uint64_t v2 = seed + PRIME64_2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME64_1;
+        const unsigned char *limit = end - 32;
+        do {
+            v1 = xxh_round(v1, read64(p)); p += 8;
+            v2 = xxh_round(v2, read64(p)); p += 8;
+            v3 = xxh_round(v3, read64(p)); p += 8;
+            v4 = xxh_round(v4, read64(p)); p += 8;
+        } while(p <= limit);
+
+        h = rotl64(v1, 1) + rotl64(v2, 7) + rotl64(v3, 12) + rotl64(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + PRIME64_5;
+    }
+
+    h += (uint64_t)len;
+
+    while(p + 8 <= end) {
+        h ^= xxh_round(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+        p += 8;
+    }
+    if(p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    while(p < end) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+        p++;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+int hash_file(const char *path, uint64_t *hash) {
+    FILE *f = fopen(path, "rb");
+    if(!f) return 0;
+
+    size_t cap = 1 << 16, len = 0, n;
+    unsigned char *buf = malloc(cap);
+    while(buf && (n = fread(buf + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if(len == cap) {
+            unsigned char *grown = realloc(buf, cap * 2);
+            if(!grown) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    fclose(f);
+    if(!buf) return 0;
+
+    *hash = hash_bytes(buf, len, 0);
+    free(buf);
+    return 1;
+}
+
+static int grow_index(HashDB *db) {
+    int size = db->index_size ? db->index_size * 2 : 1024;
+    int *index = calloc(size, sizeof(int));
+    if(!index) return 0;
+
+    for(int i = 0; i < db->count; i++) {
+        uint64_t h = hash_string(db->entries[i].path);
+        int slot = (int)(h & (size - 1));
+        while(index[slot]) slot = (slot + 1) & (size - 1);
+        index[slot] = i + 1;
+    }
+    free(db->index);
+    db->index = index;
+    db->index_size = size;
+    return 1;
+}
+
+/* entry for a path, optionally creating it; callers hold db->lock */
+static HashEntry *lookup(HashDB *db, const char *path, int create) {
+    if(db->index_size) {
+        int slot = (int)(hash_string(path) & (db->index_size - 1));
+        while(db->index[slot]) {
+            HashEntry *e = &db->entries[db->index[slot] - 1];
+            if(strcmp(e->path, path) == 0) return e;
+            slot = (slot + 1) & (db->index_size - 1);
+        }
+    }
+    if(!create) return NULL;
+
+    if(db->count == db->capacity) {
+        int capacity = db->capacity ? db->capacity * 2 : 256;
+        HashEntry *entries = realloc(db->entries, capacity * sizeof(HashEntry));
+        if(!entries) return NULL;
+        db->entries = entries;
+        db->capacity = capacity;
+    }
+    if((db->count + 1) * 2 > db->index_size && !grow_index(db)) return NULL;
+
+    HashEntry *e = &db->entries[db->count];
+    memset(e, 0, sizeof(*e));
+    snprintf(e->path, sizeof(e->path), "%s", path);
+
+    int slot = (int)(hash_string(path) & (db->index_size - 1));
+    while(db->index[slot]) slot = (slot + 1) & (db->index_size - 1);
+    db->index[slot] = ++db->count;
+    return e;
+}
+
+int hash_db_load(HashDB *db, const char *path) {
+    memset(db, 0, sizeof(*db));
+    snprintf(db->path, sizeof(db->path), "%s", path);
+    pthread_mutex_init(&db->lock, NULL);
+
+    FILE *f = fopen(path, "r");
+    if(!f) return 1;  /* first build: start empty */
+
+    char line[512];
+    if(!fgets(line, sizeof(line), f) || strncmp(line, HASH_DB_HEADER, strlen(HASH_DB_HEADER)) != 0) {
+        fclose(f);
+        return 1;
+    }
+
+    while(fgets(line, sizeof(line), f)) {
+        unsigned long long hash, signature;
+        long long size, mtime;
+        int offset = 0;
+        if(sscanf(line, "%llx %llx %lld %lld %n", &hash, &signature, &size, &mtime, &offset) != 4 || !offset) continue;
+
+        char *p = line + offset;
+        p[strcspn(p, "\n")] = 0;
+        HashEntry *e = lookup(db, p, 1);
+        if(!e) break;
+        e->hash = hash;
+        e->signature = signature;
+        e->size = size;
+        e->mtime = mtime;
+        e->valid = 1;
+    }
+    fclose(f);
+    return 1;
+}
+
+int hash_db_save(HashDB *db) {
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", db->path);
+
+    FILE *f = fopen(tmp, "w");
+    if(!f) {
+        fprintf(stderr, "Warning: Cannot write %s\n", tmp);
+        return 0;
+    }
+
+    fprintf(f, HASH_DB_HEADER "\n");
+    pthread_mutex_lock(&db->lock);
+    for(int i = 0; i < db->count; i++) {
+        HashEntry *e = &db->entries[i];
+        if(!e->valid) continue;
+        fprintf(f, "%016llx %016llx %lld %lld %s\n", (unsigned long long)e->hash,
+                (unsigned long long)e->signature, (long long)e->size, (long long)e->mtime, e->path);
+    }
+    pthread_mutex_unlock(&db->lock);
+
+    if(fclose(f) != 0 || rename(tmp, db->path) != 0) {
+        unlink(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+void hash_db_free(HashDB *db) {
+    free(db->entries);
+    free(db->index);
+    pthread_mutex_destroy(&db->lock);
+    memset(db, 0, sizeof(*db));
+}
+
+/* content hash of a file, re-reading it only when its size or mtime changed */
+int hash_db_file_hash(HashDB *db, const char *path, uint64_t *hash) {
+    struct stat st;
+    if(stat(path, &st) != 0) return 0;
+    int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+
+    pthread_mutex_lock(&db->lock);
+    HashEntry *e = lookup(db, path, 0);
+    if(e && e->valid && e->mtime == mtime && e->size == (int64_t)st.st_size) {
+        *hash = e->hash;
+        pthread_mutex_unlock(&db->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&db->lock);
+
+    uint64_t h;
+    if(!hash_file(path, &h)) return 0;
+
+    pthread_mutex_lock(&db->lock);
+    e = lookup(db, path, 1);
+    if(e) {
+        if(e->valid && e->hash != h) e->signature = 0;  /* the output changed under us */
+        e->hash = h;
+        e->size = st.st_size;
+        e->mtime = mtime;
+        e->valid = 1;
+    }
+    pthread_mutex_unlock(&db->lock);
+
+    *hash = h;
+    return 1;
+}
+
+/* last known content hash without touching the file */
+int hash_db_cached_hash(HashDB *db, const char *path, uint64_t *hash) {
+    pthread_mutex_lock(&db->lock);
+    HashEntry *e = lookup(db, path, 0);
+    int found = e && e->valid;
+    if(found) *hash = e->hash;
+    pthread_mutex_unlock(&db->lock);
+    return found;
+}
+
+uint64_t hash_db_signature(HashDB *db, const char *path) {
+    pthread_mutex_lock(&db->lock);
+    HashEntry *e = lookup(db, path, 0);
+    uint64_t signature = e && e->valid ? e->signature : 0;
+    pthread_mutex_unlock(&db->lock);
+    return signature;
+}
+
+/* record the inputs an output was built from; hashes the fresh output as well */
+void hash_db_set_signature(HashDB *db, const char *path, uint64_t signature) {
+    uint64_t h;
+    if(!hash_db_file_hash(db, path, &h)) return;
+
+    pthread_mutex_lock(&db->lock);
+    HashEntry *e = lookup(db, path, 0);
+    if(e) e->signature = signature;
+    pthread_mutex_unlock(&db->lock);
+}
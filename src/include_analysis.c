@@ -0,0 +1,393 @@
+#include "anvil.h"
+#include "colors.h"
+#include <limits.h>
+
+/*
+ * `anvil analyze-includes`: compiles every translation unit once with -H
+ * to record its include tree and compile time, then ranks headers by the
+ * compile time of the units that include them (times included x TU
+ * time). Project headers (those under the include directories) that only
+ * arrive through another header, and whose declarations neither the unit
+ * nor that header mention, are reported as removable.
+ */
+
+#define MAX_DECL_NAMES 512
+#define REPORT_ROWS 20
+
+typedef struct {
+    char path[256];         /* project relative, or absolute for system headers */
+    int project;
+    int inclusions;         /* over all units, repeats included */
+    int tus;                /* units that include it at least once */
+    int last_tu;
+    double cost_ms;         /* sum of the including units' compile times per inclusion */
+    int direct;             /* included straight from a unit's source */
+    int transitive_tus;
+    int referenced;         /* a unit or its includer mentions something it declares */
+    int via;                /* the first header seen including it, -1 for none */
+
+    int loaded;             /* names and text below are read lazily */
+    char (*names)[64];
+    int name_count;
+    char *text;
+} HeaderStats;
+
+typedef struct {
+    HeaderStats *headers;
+    int count;
+    int capacity;
+} HeaderTable;
+
+static const char *c_keywords[] = {
+    "auto", "break", "case", "char", "const", "continue", "default", "do", "double", "else",
+    "enum", "extern", "float", "for", "goto", "if", "inline", "int", "long", "register",
+    "restrict", "return", "short", "signed", "sizeof", "static", "struct", "switch", "typedef",
+    "union", "unsigned", "void", "volatile", "while", "defined", NULL
+};
+
+static int is_keyword(const char *word) {
+    for(int i = 0; c_keywords[i]; i++) {
+        if(strcmp(c_keywords[i], word) == 0) return 1;
+    }
+    return 0;
+}
+
+static int is_ident_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+/* whole file contents with #include lines blanked out, so file names never match a declaration */
+static char *read_source_text(const char *path) {
+    FILE *f = fopen(path, "r");
+    if(!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if(size < 0) {
+        fclose(f);
+        return NULL;
+    }
+
+    char *text = malloc(size + 1);
+    if(!text) {
+        fclose(f);
+        return NULL;
+    }
+    size_t n = fread(text, 1, size, f);
+    text[n] = 0;
+    fclose(f);
+
+    for(char *line = text; *line; ) {
+        char *p = line;
+        while(*p == ' ' || *p == '\t') p++;
+        char *end = strchr(line, '\n');
+        if(*p == '#') {
+            p++;
+            while(*p == ' ' || *p == '\t') p++;
+            if(strncmp(p, "include", 7) == 0) {
+                for(char *c = line; c < (end ? end : line + strlen(line)); c++) *c = ' ';
+            }
+        }
+        if(!end) break;
+        line = end + 1;
+    }
+    return text;
+}
+
+/*
+ * Names a header declares, roughly: macros, and identifiers directly
+ * followed by '(', ';', '[' or '{' (functions, variables, typedefs and
+ * tags). Struct members slip in too, which only makes a header look
+ * used more often.
+ */
+static void load_header(HeaderStats *h) {
+    h->loaded = 1;
+    if(!h->project) return;
+    h->text = read_source_text(h->path);
+    if(!h->text) return;
+    h->names = malloc(MAX_DECL_NAMES * sizeof(*h->names));
+    if(!h->names) return;
+
+    const char *p = h->text;
+    int after_define = 0;
+    while(*p && h->name_count < MAX_DECL_NAMES) {
+        if(*p == '#') {
+            const char *d = p + 1;
+            while(*d == ' ' || *d == '\t') d++;
+            after_define = strncmp(d, "define", 6) == 0;
+            p = after_define ? d + 6 : d;
+            continue;
+        }
+        if(!is_ident_char(*p) || isdigit((unsigned char)*p)) {
+            p++;
+            continue;
+        }
+
+        const char *start = p;
+        while(is_ident_char(*p)) p++;
+        size_t len = p - start;
+        const char *next = p;
+        while(*next == ' ' || *next == '\t') next++;
+
+        int declared = after_define || *next == '(' || *next == ';' || *next == '[' || *next == '{';
+        after_define = 0;
+        if(!declared || len >= 64) continue;
+
+        char word[64];
+        memcpy(word, start, len);
+        word[len] = 0;
+        if(!is_keyword(word)) strcpy(h->names[h->name_count++], word);
+    }
+}
+
+/* does text mention any name the header declares, as a whole word */
+static int mentions_header(const char *text, HeaderStats *h) {
+    if(!text) return 0;
+    for(int i = 0; i < h->name_count; i++) {
+        size_t len = strlen(h->names[i]);
+        for(const char *p = strstr(text, h->names[i]); p; p = strstr(p + 1, h->names[i])) {
+            if((p == text || !is_ident_char(p[-1])) && !is_ident_char(p[len])) return 1;
+        }
+    }
+    return 0;
+}
+
+static int find_or_add_header(HeaderTable *table, const char *path, int project) {
+    for(int i = 0; i < table->count; i++) {
+        if(strcmp(table->headers[i].path, path) == 0) return i;
+    }
+    if(table->count == table->capacity) {
+        int capacity = table->capacity ? table->capacity * 2 : 128;
+        HeaderStats *headers = realloc(table->headers, capacity * sizeof(HeaderStats));
+        if(!headers) return -1;
+        table->headers = headers;
+        table->capacity = capacity;
+    }
+
+    HeaderStats *h = &table->headers[table->count];
+    memset(h, 0, sizeof(*h));
+    snprintf(h->path, sizeof(h->path), "%.255s", path);
+    h->project = project;
+    h->last_tu = -1;
+    h->via = -1;
+    return table->count++;
+}
+
+/* -H prints paths relative to the build directory; report them relative to the project root */
+static void normalize_header(BuildConfig *cfg, const char *root, const char *path, char *out, size_t size) {
+    char joined[512], resolved[PATH_MAX];
+    if(path[0] == '/') {
+        snprintf(joined, sizeof(joined), "%s", path);
+    } else {
+        snprintf(joined, sizeof(joined), "%s/%s", cfg->build_dir, path);
+    }
+    if(!realpath(joined, resolved)) {
+        snprintf(out, size, "%s", path);
+        return;
+    }
+
+    size_t root_len = strlen(root);
+    if(strncmp(resolved, root, root_len) == 0 && resolved[root_len] == '/') {
+        snprintf(out, size, "%s", resolved + root_len + 1);
+    } else {
+        snprintf(out, size, "%s", resolved);
+    }
+}
+
+
+/* compile one unit with -H and fold its include tree into the table; returns 0 if it failed */
+static int analyze_unit(BuildConfig *cfg, BuildGraph *graph, BuildObject *obj, int tu, HeaderTable *table,
+                        WatchSet *project, const char *root) {
+    char flags[4096], cmd[8192];
+    compile_flags(cfg, graph, obj->flagset, flags, sizeof(flags));
+
+    /*
+     * -H is silent about -include, so a unit with a pch is compiled through
+     * a wrapper that includes the pch as plain text and then the source.
+     * The pch's headers are then measured like any other; the source itself
+     * shows up at depth 1 and everything below it is one level too deep.
+     */
+    FlagSet *fs = &graph->flagsets[obj->flagset];
+    char unit[300];
+    snprintf(unit, sizeof(unit), "%s/%s", cfg->source_root, obj->source);
+    if(fs->pch[0]) {
+        char wrapper[300];
+        snprintf(wrapper, sizeof(wrapper), "%s/.anvil_analyze.c", cfg->build_dir);
+        FILE *w = fopen(wrapper, "w");
+        if(!w) return 0;
+        fprintf(w, "#include \"%s/%s\"\n#include \"%s\"\n", cfg->source_root, fs->pch, unit);
+        fclose(w);
+        snprintf(unit, sizeof(unit), ".anvil_analyze.c");
+    }
+    snprintf(cmd, sizeof(cmd), "cd %s && gcc %s -H -c %s -o /dev/null 2>&1", cfg->build_dir, flags, unit);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    FILE *p = popen(cmd, "r");
+    if(!p) return 0;
+
+    /* (header, depth) of every inclusion, folded in once the compile time is known */
+    int *seen = NULL;
+    int seen_count = 0, seen_capacity = 0;
+    int stack[256];
+    char line[1024];
+    int in_source = 0;
+    while(fgets(line, sizeof(line), p)) {
+        int dots = 0;
+        while(line[dots] == '.') dots++;
+        if(dots == 0 || line[dots] != ' ' || dots >= (int)(sizeof(stack) / sizeof(stack[0]))) continue;
+        line[strcspn(line, "\n")] = 0;
+
+        char path[PATH_MAX];
+        normalize_header(cfg, root, line + dots + 1, path, sizeof(path));
+        if(fs->pch[0] && dots == 1 && strcmp(path, obj->source) == 0) {
+            in_source = 1;
+            continue;
+        }
+        int depth = in_source ? dots - 1 : dots;
+        int h = find_or_add_header(table, path, watch_set_find(project, path) >= 0);
+        if(h < 0) continue;
+        stack[depth] = h;
+
+        if(seen_count + 2 > seen_capacity) {
+            seen_capacity = seen_capacity ? seen_capacity * 2 : 256;
+            int *grown = realloc(seen, seen_capacity * sizeof(int));
+            if(!grown) break;
+            seen = grown;
+        }
+        seen[seen_count++] = h;
+        seen[seen_count++] = depth > 1 ? stack[depth - 1] : -1;
+    }
+    int status = pclose(p);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if(fs->pch[0]) {
+        char wrapper[300];
+        snprintf(wrapper, sizeof(wrapper), "%s/.anvil_analyze.c", cfg->build_dir);
+        unlink(wrapper);
+    }
+
+    if(status != 0) {
+        printf(BRIGHT_RED "FAILED:" RESET " %s" DIM " (left out of the report)" RESET "\n", obj->source);
+        free(seen);
+        return 0;
+    }
+
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    printf(DIM "[%d/%d]" RESET " %s" DIM " %.1f ms, %d inclusions" RESET "\n", tu + 1, graph->object_count,
+           obj->source, ms, seen_count / 2);
+
+    char *src_text = NULL;
+    int src_loaded = 0;
+
+    for(int i = 0; i < seen_count; i += 2) {
+        HeaderStats *h = &table->headers[seen[i]];
+        int parent = seen[i + 1];
+        h->inclusions++;
+        h->cost_ms += ms;
+        if(h->last_tu != tu) {
+            h->last_tu = tu;
+            h->tus++;
+            if(parent >= 0) h->transitive_tus++;
+        }
+        if(parent < 0) {
+            h->direct = 1;
+            continue;
+        }
+        if(h->via < 0) h->via = parent;
+        if(!h->project || h->referenced) continue;
+
+        if(!h->loaded) load_header(h);
+        HeaderStats *includer = &table->headers[parent];
+        if(!includer->loaded) load_header(includer);
+        if(!src_loaded) {
+            src_text = read_source_text(obj->source);
+            src_loaded = 1;
+        }
+        if(mentions_header(src_text, h) || mentions_header(includer->text, h)) h->referenced = 1;
+    }
+    free(src_text);
+    free(seen);
+    return 1;
+}
+
+static int costlier_first(const void *a, const void *b) {
+    const HeaderStats *x = *(const HeaderStats * const *)a;
+    const HeaderStats *y = *(const HeaderStats * const *)b;
+    return (y->cost_ms > x->cost_ms) - (y->cost_ms < x->cost_ms);
+}
+
+static void print_report(HeaderTable *table, WatchSet *project, int analyzed) {
+    HeaderStats **ranked = malloc((table->count + 1) * sizeof(HeaderStats *));
+    if(!ranked) return;
+    for(int i = 0; i < table->count; i++) ranked[i] = &table->headers[i];
+    qsort(ranked, table->count, sizeof(HeaderStats *), costlier_first);
+
+    printf("\n" BRIGHT_YELLOW "Header cost" RESET DIM " (inclusions x TU compile time, %d units)" RESET "\n", analyzed);
+    printf(DIM "  %10s  %5s  %5s  header" RESET "\n", "cost ms", "incl", "TUs");
+    for(int i = 0; i < table->count && i < REPORT_ROWS; i++) {
+        printf("  " CYAN "%10.1f" RESET "  %5d  %5d  %s%s\n", ranked[i]->cost_ms, ranked[i]->inclusions,
+               ranked[i]->tus, ranked[i]->path, ranked[i]->project ? "" : DIM " (system)" RESET);
+    }
+    if(table->count > REPORT_ROWS) printf(DIM "  ... %d more headers" RESET "\n", table->count - REPORT_ROWS);
+
+    int flagged = 0;
+    for(int i = 0; i < table->count; i++) {
+        HeaderStats *h = ranked[i];
+        if(!h->project || h->direct || h->referenced || !h->transitive_tus) continue;
+        if(!flagged++) printf("\n" BRIGHT_YELLOW "Pulled in transitively but never used" RESET "\n");
+        printf("  %s" DIM " via %s in %d unit%s, %.1f ms" RESET "\n", h->path,
+               h->via >= 0 ? table->headers[h->via].path : "?", h->transitive_tus,
+               h->transitive_tus == 1 ? "" : "s", h->cost_ms);
+    }
+
+    int unused = 0;
+    for(int i = 0; i < project->count; i++) {
+        const char *path = watch_set_path(project, i);
+        int included = 0;
+        for(int j = 0; j < table->count && !included; j++) included = strcmp(table->headers[j].path, path) == 0;
+        if(included) continue;
+        if(!unused++) printf("\n" BRIGHT_YELLOW "Not included by any unit" RESET "\n");
+        printf("  %s\n", path);
+    }
+    free(ranked);
+}
+
+int analyze_includes(BuildConfig *cfg) {
+    /* measure each source on its own even when the build batches them */
+    int unity = cfg->unity;
+    cfg->unity = 0;
+    BuildGraph *graph = build_graph_create(cfg);
+    cfg->unity = unity;
+    if(!graph) return 0;
+
+    WatchSet project = {0};
+    for(int i = 0; i < cfg->include_count; i++)
+        scan_directory_for_headers(cfg->includes[i], &project);
+    if(cfg->pch[0]) add_watch_file(cfg->pch, &project);
+
+    char root[PATH_MAX];
+    if(!realpath(".", root)) strcpy(root, ".");
+
+    printf(BRIGHT_CYAN "Analyzing the includes of %d translation unit%s..." RESET "\n",
+           graph->object_count, graph->object_count == 1 ? "" : "s");
+
+    HeaderTable table = {0};
+    int analyzed = 0;
+    for(int i = 0; i < graph->object_count; i++) {
+        int64_t start_us = trace_now_us();
+        analyzed += analyze_unit(cfg, graph, &graph->objects[i], i, &table, &project, root);
+        trace_span("analyze", graph->objects[i].source, 0, start_us);
+    }
+
+    if(analyzed > 0) print_report(&table, &project, analyzed);
+    int ok = analyzed == graph->object_count;
+
+    for(int i = 0; i < table.count; i++) {
+        free(table.headers[i].names);
+        free(table.headers[i].text);
+    }
+    free(table.headers);
+    watch_set_free(&project);
+    build_graph_free(graph);
+    return ok;
+}
@@ -0,0 +1,90 @@
+#include "anvil.h"
+#include "colors.h"
+
+/*
+ * Link step tuning: linker = mold|lld|gold|bfd|auto picks the linker gcc
+ * runs through -fuse-ld, and debug_split = on keeps DWARF in .dwo files
+ * next to the objects and compresses what remains, so links move far
+ * less debug data.
+ */
+
+/* fastest first; gcc looks these up as ld.<name> */
+static const char *auto_linkers[] = { "mold", "lld", "gold", NULL };
+
+int valid_linker(const char *name) {
+    for(int i = 0; auto_linkers[i]; i++) {
+        if(strcmp(auto_linkers[i], name) == 0) return 1;
+    }
+    return strcmp(name, "bfd") == 0 || strcmp(name, "auto") == 0;
+}
+
+static int linker_installed(const char *name) {
+    const char *path = getenv("PATH");
+    char dirs[4096];
+    snprintf(dirs, sizeof(dirs), "%s", path ? path : "/usr/bin:/bin");
+
+    for(char *dir = strtok(dirs, ":"); dir; dir = strtok(NULL, ":")) {
+        char program[512];
+        snprintf(program, sizeof(program), "%s/ld.%s", dir[0] ? dir : ".", name);
+        if(access(program, X_OK) == 0) return 1;
+    }
+    return 0;
+}
+
+/* replace the configured linker with one that is installed, "" for gcc's default */
+void resolve_linker(BuildConfig *cfg) {
+    if(!cfg->linker[0]) return;
+
+    if(strcmp(cfg->linker, "auto") == 0) {
+        cfg->linker_probed = 1;
+        cfg->linker[0] = 0;
+        for(int i = 0; auto_linkers[i]; i++) {
+            if(linker_installed(auto_linkers[i])) {
+                snprintf(cfg->linker, sizeof(cfg->linker), "%s", auto_linkers[i]);
+                break;
+            }
+        }
+        return;
+    }
+
+    if(!linker_installed(cfg->linker)) {
+        fprintf(stderr, "Warning: Linker '%s' is not installed (no ld.%s in PATH), using the default\n", cfg->linker, cfg->linker);
+        cfg->linker[0] = 0;
+    }
+}
+
+/* say what linker = auto settled on; once per run, not on every reload */
+void report_linker(const BuildConfig *cfg) {
+    if(cfg->linker_probed) printf(DIM "Linker: %s" RESET "\n", cfg->linker[0] ? cfg->linker : "default");
+}
+
+/* -g, -g1 to -g3 and -ggdb*; -g0 turns debug info off and -gz only compresses it */
+static int selects_debug_info(const char *flag) {
+    if(strncmp(flag, "-ggdb", 5) == 0) return 1;
+    return strcmp(flag, "-g") == 0 || strcmp(flag, "-g1") == 0 || strcmp(flag, "-g2") == 0 || strcmp(flag, "-g3") == 0;
+}
+
+/* compile flags for debug_split; -g is added only when the cflags do not already pick a debug level */
+void debug_flags(BuildConfig *cfg, char *out, size_t size) {
+    out[0] = 0;
+    if(!cfg->debug_split) return;
+
+    int has_debug = 0;
+    for(int i = 0; i < cfg->cflag_count; i++) {
+        if(selects_debug_info(cfg->cflags[i])) has_debug = 1;
+    }
+    snprintf(out, size, "%s-gsplit-dwarf -gz", has_debug ? "" : "-g ");
+}
+
+/* flags every link gets: the linker choice and, with debug_split, an index of the .dwo files */
+void link_flags(BuildConfig *cfg, char *out, size_t size) {
+    size_t len = 0;
+    out[0] = 0;
+    if(cfg->linker[0])
+        len += snprintf(out, size, "-fuse-ld=%s", cfg->linker);
+    if(!cfg->debug_split || len >= size) return;
+
+    /* bfd cannot build a .gdb_index; the others save gdb from scanning every .dwo */
+    int gdb_index = cfg->linker[0] && strcmp(cfg->linker, "bfd") != 0;
+    snprintf(out + len, size - len, "%s-gz%s", len ? " " : "", gdb_index ? " -Wl,--gdb-index" : "");
+}
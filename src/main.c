@@ -55,32 +55,82 @@ void print_config(BuildConfig *cfg) {
     printf("Includes: %d directories\n", cfg->include_count);
 
     if(strcmp(cfg->output_dir, ".") == 0) {
-        printf("Output: build/%s\n", cfg->target_name);
+        printf("Output: %s/%s\n", cfg->build_dir, cfg->target_name);
     } else {
-        printf("Output: build/%s/%s\n", cfg->output_dir, cfg->target_name);
+        printf("Output: %s/%s/%s\n", cfg->build_dir, cfg->output_dir, cfg->target_name);
     }
     printf("\n");
 }
 
-int setup_build_dirs() {
-    if(!create_directory("build")) return 0;
-    if(!create_directory("build/obj")) return 0;
-    return 1;
+int setup_build_dirs(BuildConfig *cfg) {
+    char obj_dir[256];
+    snprintf(obj_dir, sizeof(obj_dir), "%s/obj", cfg->build_dir);
+    return create_directory_recursive(obj_dir);
+}
+
+/* generate and then build, watch or print instructions for one (possibly variant) config */
+static int run_config(BuildConfig *cfg, int watch, int run_after_build, int build) {
+    if(!setup_build_dirs(cfg)) return 1;
+
+    printf("\n");
+    if(cfg->variant[0]) printf(BRIGHT_CYAN "Variant " BOLD "%s" RESET "\n", cfg->variant);
+    if(!generate_build_files(cfg)) return 1;
+
+    if(watch) {
+        watch_mode(cfg, run_after_build);
+    } 
+    else if(build) {
+        printf("\n");
+        if(cfg->optimize & OPTIMIZE_PGO) return pgo_build(cfg, cfg->jobs) ? 0 : 1;
+        return execute_build(cfg, cfg->jobs) ? 0 : 1;
+    }
+    else if(strcmp(config_generator(cfg)->name, "ninja") == 0) {
+        printf("\n" BRIGHT_YELLOW "To build your project:" RESET "\n");
+        printf("  " CYAN "cd %s" RESET "\n", cfg->build_dir);
+        printf("  " CYAN "ninja" RESET "          " DIM "# compile" RESET "\n");
+        printf("  " CYAN "ninja run" RESET "      " DIM "# compile and run" RESET "\n");
+        printf("  " CYAN "ninja -t clean" RESET " " DIM "# clean build artifacts" RESET "\n");
+    }
+    else {
+        printf("\n" BRIGHT_YELLOW "To build your project:" RESET "\n");
+        printf("  " CYAN "cd %s" RESET "\n", cfg->build_dir);
+        printf("  " CYAN "make" RESET "           " DIM "# compile" RESET "\n");
+        printf("  " CYAN "make run" RESET "       " DIM "# compile and run" RESET "\n");
+        printf("  " CYAN "make clean" RESET "     " DIM "# clean build artifacts" RESET "\n");
+    }
+
+    return 0;
 }
 
 int main(int argc, char *argv[]) {
     int watch = 0;
     int run_after_build = 0;
+    int build = 0;
+    int analyze = 0;
+    int daemon = 0;
+    int jobs = 0;
+    char *generator = NULL;
+    char *variants = NULL;
     char *config_file = NULL;
 
     if(argc < 2) {
-        printf("Usage: %s [-v|-w|-wr|-u|-c] <buildfile>\n", argv[0]);
+        printf("Usage: %s [build|analyze-includes] [-v|-w|-wr|-j N|-u|-c] <buildfile>\n", argv[0]);
+        printf("\nCommands:\n");
+        printf("  build       Build with the built-in parallel executor instead of make\n");
+        printf("  analyze-includes  Rank headers by the compile time they cost\n");
+        printf("  client      Ask a running daemon to build (or: client status, client stop)\n");
+        printf("  worker      Serve compile jobs for remote builds (--port N, --listen ADDR, --stdio)\n");
         printf("\nOptions:\n");
         printf("  -v          Show version information\n");
         printf("  -w          Watch mode (auto-rebuild on file changes)\n");
         printf("  -wr         Watch & Run mode (auto-rebuild and run on file changes)\n");
         printf("  -u          Update to latest version\n");
         printf("  -u <ver>    Update to specific version (e.g., -u 1.1.0)\n");
+        printf("  -j N        Parallel jobs for the built-in executor (default: one per core)\n");
+        printf("  -G <name>   Build file generator: make (default) or ninja\n");
+        printf("  --variant <a,b>  Build these [variant:...] blocks side by side (or 'all')\n");
+        printf("  --daemon    Keep the build state in memory and serve builds on build/anvil.sock\n");
+        printf("  --trace     Write a timing trace to " TRACE_FILE "\n");
         printf("  -c          Create new project template\n");
         printf("\nExample buildfile format:\n");
         printf("  project = MyProject\n");
@@ -91,6 +141,8 @@ int main(int argc, char *argv[]) {
         printf("  cflags = -Wall -O2\n");
         printf("  ldflags = -lm\n");
         printf("  output_dir = bin\n");
+        printf("  generator = make\n");
+        printf("  jobs = 8\n");
         return 1;
     }
 
@@ -110,6 +162,10 @@ int main(int argc, char *argv[]) {
                 printf(BRIGHT_CYAN "Updating to latest version..." RESET "\n");
                 return update_to_latest() ? 0 : 1;
             }
+        } else if(strcmp(argv[i], "client") == 0) {
+            return daemon_client(argc - i - 1, argv + i + 1);
+        } else if(strcmp(argv[i], "worker") == 0) {
+            return run_worker(argc - i - 1, argv + i + 1);
         } else if(strcmp(argv[i], "-c") == 0 || strcmp(argv[i], "--create") == 0) {
             return create_project_template() ? 0 : 1;
         } else if(strcmp(argv[i], "-w") == 0) {
@@ -117,6 +173,22 @@ int main(int argc, char *argv[]) {
         } else if(strcmp(argv[i], "-wr") == 0) {
             watch = 1;
             run_after_build = 1;
+        } else if(strcmp(argv[i], "build") == 0) {
+            build = 1;
+        } else if(strcmp(argv[i], "analyze-includes") == 0) {
+            analyze = 1;
+        } else if(strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if(strncmp(argv[i], "-j", 2) == 0 && isdigit((unsigned char)argv[i][2])) {
+            jobs = atoi(argv[i] + 2);
+        } else if(strcmp(argv[i], "-G") == 0 && i + 1 < argc) {
+            generator = argv[++i];
+        } else if(strcmp(argv[i], "--variant") == 0 && i + 1 < argc) {
+            variants = argv[++i];
+        } else if(strcmp(argv[i], "--daemon") == 0) {
+            daemon = 1;
+        } else if(strcmp(argv[i], "--trace") == 0) {
+            trace_enable();
         } else {
             config_file = argv[i];
         }
@@ -127,29 +199,63 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
+    /* the daemon parses and reloads the config itself */
+    if(daemon) return daemon_mode(config_file, jobs, generator, variants);
+
     show_config_content(config_file);
 
     BuildConfig cfg;
+    int64_t start_us = trace_now_us();
     if(!parse_buildfile(config_file, &cfg)) {
         return 1;
     }
+    trace_span("phase", "parse_buildfile", 0, start_us);
 
-    if(!setup_build_dirs()) return 1;
+    cfg.cli_jobs = jobs;
+    if(generator) snprintf(cfg.cli_generator, sizeof(cfg.cli_generator), "%s", generator);
+    apply_command_line(&cfg);
+    cfg.use_executor = build;
 
-    printf("\n");
-    generate_makefile(&cfg);
-    printf(BRIGHT_GREEN "Generated build/Makefile successfully!" RESET "\n");
+    if(analyze) {
+        if(!setup_build_dirs(&cfg)) return 1;
+        int ok = analyze_includes(&cfg);
+        trace_write(TRACE_FILE);
+        return ok ? 0 : 1;
+    }
 
-    if(watch) {
-        watch_mode(&cfg, run_after_build);
-    } 
-    else {
-        printf("\n" BRIGHT_YELLOW "To build your project:" RESET "\n");
-        printf("  " CYAN "cd build" RESET "\n");
-        printf("  " CYAN "make" RESET "           " DIM "# compile" RESET "\n");
-        printf("  " CYAN "make run" RESET "       " DIM "# compile and run" RESET "\n");
-        printf("  " CYAN "make clean" RESET "     " DIM "# clean build artifacts" RESET "\n");
+    report_linker(&cfg);
+
+    /* without variants everything builds in build/ as before */
+    char names[MAX_VARIANTS][64];
+    int count = select_variants(&cfg, variants ? variants : cfg.default_variants, names, MAX_VARIANTS);
+    if(count < 0) return 1;
+    if(count == 0) {
+        int result = run_config(&cfg, watch, run_after_build, build);
+        trace_write(TRACE_FILE);
+        return result;
     }
 
-    return 0;
+    if(watch && count > 1) {
+        fprintf(stderr, "Error: Watch mode follows a single variant\n");
+        return 1;
+    }
+
+    /* each variant gets its own copy of the config with its flags overlaid */
+    BuildConfig *variant_cfg = malloc(sizeof(BuildConfig));
+    if(!variant_cfg) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 1;
+    }
+    int result = 0;
+    for(int i = 0; i < count && result == 0; i++) {
+        *variant_cfg = cfg;
+        if(!apply_variant(variant_cfg, names[i])) {
+            result = 1;
+            break;
+        }
+        result = run_config(variant_cfg, watch, run_after_build, build);
+    }
+    free(variant_cfg);
+    trace_write(TRACE_FILE);
+    return result;
 }
\ No newline at end of file
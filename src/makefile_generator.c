@@ -1,14 +1,13 @@
 #include "anvil.h"
 
-void generate_makefile(BuildConfig *cfg) {
-    FILE *f = fopen("build/Makefile", "w");
-    if(!f) {
-        fprintf(stderr, "Error: Cannot create build/Makefile\n");
-        return;
-    }
+int generate_makefile(BuildConfig *cfg, FILE *f) {
+    BuildGraph *graph = build_graph_create(cfg);
+    if(!graph) return 0;
 
     fprintf(f, "# Generated Makefile for %s v%s\n\n", cfg->project_name, cfg->version);
     fprintf(f, "CC = gcc\n");
+    /* LTO objects carry GIMPLE; gcc-ar loads the plugin so archives get a usable symbol index */
+    fprintf(f, "AR = %s\n", cfg->optimize & OPTIMIZE_LTO ? "gcc-ar" : "ar");
     fprintf(f, "OBJ_DIR = obj\n");
     fprintf(f, "VERSION = %s\n", cfg->version);
 
@@ -16,7 +15,20 @@ void generate_makefile(BuildConfig *cfg) {
     if(use_bin_dir) {
         fprintf(f, "BIN_DIR = %s\n", cfg->output_dir);
     }
-    fprintf(f, "SRC_DIR = ..\n\n");
+    fprintf(f, "SRC_DIR = %s\n\n", cfg->source_root);
+
+    if(cfg->optimize) {
+        char opt[1024];
+        optimize_flags(cfg, opt, sizeof(opt));
+        fprintf(f, "OPTFLAGS = %s\n", opt);
+    }
+    char debug[128], link[128];
+    debug_flags(cfg, debug, sizeof(debug));
+    link_flags(cfg, link, sizeof(link));
+    if(debug[0])
+        fprintf(f, "DEBUGFLAGS = %s\n", debug);
+    if(link[0])
+        fprintf(f, "LINKFLAGS = %s\n", link);
 
     fprintf(f, "CFLAGS = -DVERSION=\\\"$(VERSION)\\\"");
     for(int i = 0; i < cfg->cflag_count; i++)
@@ -24,72 +36,157 @@ void generate_makefile(BuildConfig *cfg) {
 
     for(int i = 0; i < cfg->include_count; i++)
         fprintf(f, " -I$(SRC_DIR)/%s", cfg->includes[i]);
-    fprintf(f, "\n\n");
+    if(cfg->optimize)
+        fprintf(f, " $(OPTFLAGS)");
+    if(debug[0])
+        fprintf(f, " $(DEBUGFLAGS)");
+    fprintf(f, "\n");
+
+    /* let the compiler record header dependencies next to each object */
+    fprintf(f, "DEPFLAGS = -MMD -MP\n\n");
 
     /* Generate variables and rules for each target */
-    fprintf(f, "# Targets\n");
-    fprintf(f, "TARGETS =");
+    char outputs[MAX_TARGETS][256];
     for(int t = 0; t < cfg->target_count; t++) {
+        char name[160];
+        target_output_name(&cfg->targets[t], name, sizeof(name));
         if(use_bin_dir) {
-            fprintf(f, " $(BIN_DIR)/%s", cfg->targets[t].name);
+            snprintf(outputs[t], sizeof(outputs[t]), "$(BIN_DIR)/%s", name);
         } else {
-            fprintf(f, " %s", cfg->targets[t].name);
+            snprintf(outputs[t], sizeof(outputs[t]), "%s", name);
         }
     }
+
+    fprintf(f, "# Targets\n");
+    fprintf(f, "TARGETS =");
+    for(int t = 0; t < cfg->target_count; t++) {
+        fprintf(f, " %s", outputs[t]);
+    }
     fprintf(f, "\n\n");
 
     fprintf(f, "all: $(TARGETS)\n\n");
 
+    /* per-target flag sets; objects built with the same flags are shared */
+    for(int i = 1; i < graph->flagset_count; i++) {
+        fprintf(f, "CFLAGS_%s = $(CFLAGS) %s\n", graph->flagsets[i].name, graph->flagsets[i].flags);
+    }
+    if(graph->flagset_count > 1) fprintf(f, "\n");
+
+    /* precompiled headers, one per flag set that asks for one */
+    int has_pch = 0;
+    for(int i = 0; i < graph->flagset_count; i++) {
+        FlagSet *fs = &graph->flagsets[i];
+        if(!fs->pch[0]) continue;
+        char path[192];
+        pch_path(graph, i, path, sizeof(path));
+        fprintf(f, "PCH%s%s = $(OBJ_DIR)/%s\n", fs->name[0] ? "_" : "", fs->name, path);
+        fprintf(f, "PCHFLAGS%s%s = -Winvalid-pch -include $(PCH%s%s)\n", fs->name[0] ? "_" : "", fs->name,
+                fs->name[0] ? "_" : "", fs->name);
+        has_pch = 1;
+    }
+    if(has_pch) fprintf(f, "\n");
+
     /* generate rules for each target */
     for(int t = 0; t < cfg->target_count; t++) {
         Target *target = &cfg->targets[t];
         
-        fprintf(f, "# Target: %s\n", target->name);
+        fprintf(f, "# %s: %s\n", target->kind == TARGET_EXECUTABLE ? "Target" : "Library", target->name);
         fprintf(f, "%s_SOURCES =", target->name);
         for(int i = 0; i < target->source_count; i++)
             fprintf(f, " $(SRC_DIR)/%s", target->sources[i]);
         fprintf(f, "\n");
 
         fprintf(f, "%s_OBJECTS =", target->name);
-        for(int i = 0; i < target->source_count; i++) {
-            char basename[128];
-            strcpy(basename, target->sources[i]);
-            char *last_slash = strrchr(basename, '/');
-            char *name = last_slash ? last_slash + 1 : basename;
-            char *dot = strrchr(name, '.');
-            if(dot) *dot = 0;
-            fprintf(f, " $(OBJ_DIR)/%s_%s.o", target->name, name);
+        for(int i = 0; i < graph->target_object_count[t]; i++)
+            fprintf(f, " $(OBJ_DIR)/%s", graph->objects[graph->target_objects[t][i]].object);
+        fprintf(f, "\n");
+
+        if(target->kind == TARGET_STATIC_LIBRARY) {
+            /* archives are not linked; their ldflags travel to whoever links them */
+            fprintf(f, "\n%s: $(%s_OBJECTS)%s\n", outputs[t], target->name, use_bin_dir ? " | $(BIN_DIR)" : "");
+            fprintf(f, "\trm -f $@\n");
+            fprintf(f, "\t$(AR) rcs $@ $(%s_OBJECTS)\n", target->name);
+            fprintf(f, "\t@echo \"Build complete: %s\"\n\n", outputs[t]);
+            continue;
         }
+
+        /* libraries this target links, and the ldflags static ones bring along */
+        fprintf(f, "%s_LIBS =", target->name);
+        for(int i = 0; i < graph->target_link_count[t]; i++)
+            fprintf(f, " %s", outputs[graph->target_links[t][i]]);
         fprintf(f, "\n");
 
+        int has_shared = 0;
         fprintf(f, "%s_LDFLAGS =", target->name);
         for(int i = 0; i < target->ldflag_count; i++)
             fprintf(f, " %s", target->ldflags[i]);
+        for(int i = 0; i < graph->target_link_count[t]; i++) {
+            Target *lib = &cfg->targets[graph->target_links[t][i]];
+            if(lib->kind == TARGET_SHARED_LIBRARY) {
+                has_shared = 1;
+                continue;
+            }
+            for(int j = 0; j < lib->ldflag_count; j++)
+                fprintf(f, " %s", lib->ldflags[j]);
+        }
+        /* shared libraries sit next to the executables that load them */
+        if(has_shared)
+            fprintf(f, " -Wl,-rpath,'$$ORIGIN'");
         fprintf(f, "\n\n");
 
-        if(use_bin_dir) {
-            fprintf(f, "$(BIN_DIR)/%s: $(%s_OBJECTS) | $(BIN_DIR)\n", target->name, target->name);
-            fprintf(f, "\t$(CC) $(%s_OBJECTS) -o $(BIN_DIR)/%s $(%s_LDFLAGS)\n", target->name, target->name, target->name);
-            fprintf(f, "\t@echo \"Build complete: $(BIN_DIR)/%s\"\n\n", target->name);
-        } else {
-            fprintf(f, "%s: $(%s_OBJECTS)\n", target->name, target->name);
-            fprintf(f, "\t$(CC) $(%s_OBJECTS) -o %s $(%s_LDFLAGS)\n", target->name, target->name, target->name);
-            fprintf(f, "\t@echo \"Build complete: %s\"\n\n", target->name);
-        }
+        /* a soname makes dependents record the bare file name, which the rpath then finds */
+        char shared[200] = "";
+        if(target->kind == TARGET_SHARED_LIBRARY) snprintf(shared, sizeof(shared), " -shared -Wl,-soname,lib%s.so", target->name);
+        fprintf(f, "%s: $(%s_OBJECTS) $(%s_LIBS)%s\n", outputs[t], target->name, target->name, use_bin_dir ? " | $(BIN_DIR)" : "");
+        fprintf(f, "\t$(CC)%s%s%s $(%s_OBJECTS) $(%s_LIBS) -o %s $(%s_LDFLAGS)\n",
+                shared, cfg->optimize ? " $(OPTFLAGS)" : "",
+                link[0] ? " $(LINKFLAGS)" : "", target->name, target->name, outputs[t], target->name);
+        fprintf(f, "\t@echo \"Build complete: %s\"\n\n", outputs[t]);
+    }
+
+    /* one rule per unique object, shared by every target that uses it */
+    fprintf(f, "# Objects\n");
+    fprintf(f, "OBJECTS =");
+    for(int i = 0; i < graph->object_count; i++)
+        fprintf(f, " $(OBJ_DIR)/%s", graph->objects[i].object);
+    fprintf(f, "\n\n");
 
-        for(int i = 0; i < target->source_count; i++) {
-            char basename[128];
-            strcpy(basename, target->sources[i]);
-            char *last_slash = strrchr(basename, '/');
-            char *name = last_slash ? last_slash + 1 : basename;
-            char *dot = strrchr(name, '.');
-            if(dot) *dot = 0;
+    for(int i = 0; i < graph->object_count; i++) {
+        BuildObject *obj = &graph->objects[i];
+        FlagSet *fs = &graph->flagsets[obj->flagset];
+        const char *sep = fs->name[0] ? "_" : "";
+
+        fprintf(f, "$(OBJ_DIR)/%s: $(SRC_DIR)/%s", obj->object, obj->source);
+        if(fs->pch[0]) fprintf(f, " $(PCH%s%s).gch", sep, fs->name);
+        fprintf(f, " | $(OBJ_DIR)\n");
+        fprintf(f, "\t$(CC) $(CFLAGS%s%s)", sep, fs->name);
+        if(fs->pch[0]) fprintf(f, " $(PCHFLAGS%s%s)", sep, fs->name);
+        fprintf(f, " $(DEPFLAGS) -c $< -o $@\n\n");
+    }
 
-            fprintf(f, "$(OBJ_DIR)/%s_%s.o: $(SRC_DIR)/%s | $(OBJ_DIR)\n", target->name, name, target->sources[i]);
-            fprintf(f, "\t$(CC) $(CFLAGS) -c $< -o $@\n\n");
+    /* the header is compiled with exactly the flags of the objects that include it */
+    if(has_pch) {
+        fprintf(f, "PCHS =");
+        for(int i = 0; i < graph->flagset_count; i++) {
+            FlagSet *fs = &graph->flagsets[i];
+            if(fs->pch[0]) fprintf(f, " $(PCH%s%s).gch", fs->name[0] ? "_" : "", fs->name);
+        }
+        fprintf(f, "\n\n");
+
+        for(int i = 0; i < graph->flagset_count; i++) {
+            FlagSet *fs = &graph->flagsets[i];
+            if(!fs->pch[0]) continue;
+            const char *sep = fs->name[0] ? "_" : "";
+            fprintf(f, "$(PCH%s%s).gch: $(SRC_DIR)/%s | $(OBJ_DIR)\n", sep, fs->name, fs->pch);
+            fprintf(f, "\t@mkdir -p $(@D)\n");
+            fprintf(f, "\t$(CC) $(CFLAGS%s%s) $(DEPFLAGS) -x c-header $< -o $@\n\n", sep, fs->name);
         }
     }
 
+    fprintf(f, "-include $(OBJECTS:.o=.d)\n");
+    if(has_pch) fprintf(f, "-include $(PCHS:.gch=.d)\n");
+    fprintf(f, "\n");
+
     fprintf(f, "$(OBJ_DIR):\n");
     fprintf(f, "\tmkdir -p $(OBJ_DIR)\n\n");
 
@@ -98,29 +195,30 @@ void generate_makefile(BuildConfig *cfg) {
         fprintf(f, "\tmkdir -p $(BIN_DIR)\n\n");
     }
 
+    /* short names for targets whose output is named differently, as `make <target>` */
+    for(int t = 0; t < cfg->target_count; t++) {
+        if(strcmp(outputs[t], cfg->targets[t].name) != 0)
+            fprintf(f, "%s: %s\n\n", cfg->targets[t].name, outputs[t]);
+    }
+
     /* generate run targets for each executable */
+    int executable_count = 0;
+    int last_executable = -1;
     for(int t = 0; t < cfg->target_count; t++) {
         Target *target = &cfg->targets[t];
-        fprintf(f, "run-%s: ", target->name);
-        if(use_bin_dir) {
-            fprintf(f, "$(BIN_DIR)/%s\n", target->name);
-        } else {
-            fprintf(f, "%s\n", target->name);
-        }
+        if(target->kind != TARGET_EXECUTABLE) continue;
+        executable_count++;
+        last_executable = t;
+
+        fprintf(f, "run-%s: %s\n", target->name, outputs[t]);
         fprintf(f, "\t@echo \"Running %s...\"\n", target->name);
         fprintf(f, "\t@echo \"\"\n");
-        fprintf(f, "\t@");
-        if(use_bin_dir) {
-            fprintf(f, "$(BIN_DIR)/%s", target->name);
-        } else {
-            fprintf(f, "./%s", target->name);
-        }
-        fprintf(f, "\n\n");
+        fprintf(f, "\t@%s%s\n\n", use_bin_dir ? "" : "./", outputs[t]);
     }
 
-    /* backward compatibility: if only one target, create 'run' alias */
-    if(cfg->target_count == 1) {
-        fprintf(f, "run: run-%s\n\n", cfg->targets[0].name);
+    /* backward compatibility: if only one executable, create 'run' alias */
+    if(executable_count == 1) {
+        fprintf(f, "run: run-%s\n\n", cfg->targets[last_executable].name);
     }
 
     fprintf(f, "clean:\n");
@@ -129,12 +227,16 @@ void generate_makefile(BuildConfig *cfg) {
 
     fprintf(f, ".PHONY: all clean");
     for(int t = 0; t < cfg->target_count; t++) {
-        fprintf(f, " run-%s", cfg->targets[t].name);
+        if(strcmp(outputs[t], cfg->targets[t].name) != 0)
+            fprintf(f, " %s", cfg->targets[t].name);
+        if(cfg->targets[t].kind == TARGET_EXECUTABLE)
+            fprintf(f, " run-%s", cfg->targets[t].name);
     }
-    if(cfg->target_count == 1) {
+    if(executable_count == 1) {
         fprintf(f, " run");
     }
     fprintf(f, "\n");
 
-    fclose(f);
+    build_graph_free(graph);
+    return 1;
 }
\ No newline at end of file
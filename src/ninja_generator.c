@@ -0,0 +1,238 @@
+#include "anvil.h"
+
+/* ninja treats '$', ':' and ' ' specially in paths */
+static void ninja_path(FILE *f, const char *path) {
+    for(const char *p = path; *p; p++) {
+        if(*p == '$' || *p == ':' || *p == ' ') fputc('$', f);
+        fputc(*p, f);
+    }
+}
+
+/* the make-style depfile next to an output: obj/foo.o -> obj/foo.d */
+static void ninja_depfile(FILE *f, const char *output) {
+    const char *dot = strrchr(output, '.');
+    size_t len = dot ? (size_t)(dot - output) : strlen(output);
+    char base[256];
+    snprintf(base, sizeof(base), "%.*s", (int)len, output);
+    fprintf(f, "  dep = obj/");
+    ninja_path(f, base);
+    fprintf(f, ".d\n");
+}
+
+int generate_ninja(BuildConfig *cfg, FILE *f) {
+    BuildGraph *graph = build_graph_create(cfg);
+    if(!graph) return 0;
+
+    int jobs = cfg->jobs > 0 ? cfg->jobs : default_job_count();
+
+    fprintf(f, "# Generated build.ninja for %s v%s\n\n", cfg->project_name, cfg->version);
+    fprintf(f, "ninja_required_version = 1.3\n\n");
+    fprintf(f, "cc = gcc\n");
+    fprintf(f, "ar = %s\n", cfg->optimize & OPTIMIZE_LTO ? "gcc-ar" : "ar");
+    if(cfg->optimize) {
+        char opt[1024];
+        optimize_flags(cfg, opt, sizeof(opt));
+        fprintf(f, "optflags = %s\n", opt);
+    }
+    char debug[128], link[128];
+    debug_flags(cfg, debug, sizeof(debug));
+    link_flags(cfg, link, sizeof(link));
+    if(debug[0])
+        fprintf(f, "debugflags = %s\n", debug);
+    if(link[0])
+        fprintf(f, "linkflags = %s\n", link);
+    fprintf(f, "\n");
+
+    fprintf(f, "cflags = -DVERSION=\\\"%s\\\"", cfg->version);
+    for(int i = 0; i < cfg->cflag_count; i++)
+        fprintf(f, " %s", cfg->cflags[i]);
+    for(int i = 0; i < cfg->include_count; i++)
+        fprintf(f, " -I%s/%s", cfg->source_root, cfg->includes[i]);
+    if(cfg->optimize)
+        fprintf(f, " $optflags");
+    if(debug[0])
+        fprintf(f, " $debugflags");
+    fprintf(f, "\n");
+
+    /* per-target flag sets; objects built with the same flags are shared */
+    for(int i = 1; i < graph->flagset_count; i++)
+        fprintf(f, "cflags_%s = $cflags %s\n", graph->flagsets[i].name, graph->flagsets[i].flags);
+    fprintf(f, "\n");
+
+    /* compiles fill the machine, links are memory hungry and get fewer slots */
+    fprintf(f, "pool compile_pool\n");
+    fprintf(f, "  depth = %d\n\n", jobs);
+    fprintf(f, "pool link_pool\n");
+    fprintf(f, "  depth = %d\n\n", (jobs + 3) / 4);
+
+    /*
+     * Depfiles are left where the Makefile and the executor put them
+     * (obj/foo.d), rather than folded into .ninja_deps, so watch mode and
+     * the daemon can read them whichever generator built the objects.
+     */
+    fprintf(f, "rule cc\n");
+    fprintf(f, "  command = $cc $cflags $pchflags -MMD -MP -MF $dep -c $in -o $out\n");
+    fprintf(f, "  depfile = $dep\n");
+    fprintf(f, "  description = CC $in\n");
+    fprintf(f, "  pool = compile_pool\n\n");
+
+    fprintf(f, "rule pch\n");
+    fprintf(f, "  command = $cc $cflags -MMD -MP -MF $dep -x c-header $in -o $out\n");
+    fprintf(f, "  depfile = $dep\n");
+    fprintf(f, "  description = PCH $in\n");
+    fprintf(f, "  pool = compile_pool\n\n");
+
+    /* archives are only replaced when their bytes change, so restat lets ninja skip the relinks */
+    fprintf(f, "rule archive\n");
+    fprintf(f, "  command = rm -f $out.tmp && $ar rcsD $out.tmp $in && "
+               "(cmp -s $out.tmp $out && rm -f $out.tmp || mv -f $out.tmp $out)\n");
+    fprintf(f, "  description = AR $out\n");
+    fprintf(f, "  restat = 1\n\n");
+
+    fprintf(f, "rule link\n");
+    fprintf(f, "  command = $cc $optflags $linkflags $in $libs -o $out $ldflags\n");
+    fprintf(f, "  description = LINK $out\n");
+    fprintf(f, "  pool = link_pool\n");
+    fprintf(f, "  restat = 1\n\n");
+
+    fprintf(f, "rule solink\n");
+    fprintf(f, "  command = $cc -shared -Wl,-soname,$soname $optflags $linkflags $in $libs -o $out $ldflags\n");
+    fprintf(f, "  description = SOLINK $out\n");
+    fprintf(f, "  pool = link_pool\n");
+    fprintf(f, "  restat = 1\n\n");
+
+    fprintf(f, "rule run\n");
+    fprintf(f, "  command = ./$in\n");
+    fprintf(f, "  description = RUN $in\n");
+    fprintf(f, "  pool = console\n\n");
+
+    /* precompiled headers share their flag set's cflags */
+    char pchs[MAX_TARGETS + 1][192];
+    int has_pch = 0;
+    for(int i = 0; i < graph->flagset_count; i++) {
+        FlagSet *fs = &graph->flagsets[i];
+        pch_path(graph, i, pchs[i], sizeof(pchs[i]));
+        if(!fs->pch[0]) continue;
+        if(!has_pch++) fprintf(f, "# Precompiled headers\n");
+        fprintf(f, "build obj/");
+        ninja_path(f, pchs[i]);
+        fprintf(f, ".gch: pch %s/", cfg->source_root);
+        ninja_path(f, fs->pch);
+        fprintf(f, "\n");
+        char gch[200];
+        snprintf(gch, sizeof(gch), "%.191s.gch", pchs[i]);
+        ninja_depfile(f, gch);
+        if(fs->name[0]) fprintf(f, "  cflags = $cflags_%s\n", fs->name);
+    }
+    if(has_pch) fprintf(f, "\n");
+
+    /* one build edge per unique object */
+    fprintf(f, "# Objects\n");
+    for(int i = 0; i < graph->object_count; i++) {
+        BuildObject *obj = &graph->objects[i];
+        FlagSet *fs = &graph->flagsets[obj->flagset];
+        fprintf(f, "build obj/");
+        ninja_path(f, obj->object);
+        fprintf(f, ": cc %s/", cfg->source_root);
+        ninja_path(f, obj->source);
+        if(fs->pch[0]) {
+            fprintf(f, " | obj/");
+            ninja_path(f, pchs[obj->flagset]);
+            fprintf(f, ".gch");
+        }
+        fprintf(f, "\n");
+        ninja_depfile(f, obj->object);
+        if(fs->name[0])
+            fprintf(f, "  cflags = $cflags_%s\n", fs->name);
+        if(fs->pch[0])
+            fprintf(f, "  pchflags = -Winvalid-pch -include obj/%s\n", pchs[obj->flagset]);
+    }
+    fprintf(f, "\n");
+
+    char outputs[MAX_TARGETS][256];
+    for(int t = 0; t < cfg->target_count; t++)
+        target_output_path(cfg, &cfg->targets[t], outputs[t], sizeof(outputs[t]));
+
+    for(int t = 0; t < cfg->target_count; t++) {
+        Target *target = &cfg->targets[t];
+        const char *rule = target->kind == TARGET_STATIC_LIBRARY ? "archive"
+                         : target->kind == TARGET_SHARED_LIBRARY ? "solink" : "link";
+
+        fprintf(f, "# %s: %s\n", target->kind == TARGET_EXECUTABLE ? "Target" : "Library", target->name);
+        fprintf(f, "build ");
+        ninja_path(f, outputs[t]);
+        fprintf(f, ": %s", rule);
+        for(int i = 0; i < graph->target_object_count[t]; i++) {
+            fprintf(f, " obj/");
+            ninja_path(f, graph->objects[graph->target_objects[t][i]].object);
+        }
+        if(graph->target_link_count[t] > 0 && target->kind != TARGET_STATIC_LIBRARY) {
+            fprintf(f, " |");
+            for(int i = 0; i < graph->target_link_count[t]; i++) {
+                fprintf(f, " ");
+                ninja_path(f, outputs[graph->target_links[t][i]]);
+            }
+        }
+        fprintf(f, "\n");
+
+        if(target->kind == TARGET_STATIC_LIBRARY) {
+            fprintf(f, "\n");
+            continue;
+        }
+        if(target->kind == TARGET_SHARED_LIBRARY)
+            fprintf(f, "  soname = lib%s.so\n", target->name);
+
+        int has_shared = 0;
+        fprintf(f, "  libs =");
+        for(int i = 0; i < graph->target_link_count[t]; i++) {
+            Target *lib = &cfg->targets[graph->target_links[t][i]];
+            fprintf(f, " %s", outputs[graph->target_links[t][i]]);
+            if(lib->kind == TARGET_SHARED_LIBRARY) has_shared = 1;
+        }
+        fprintf(f, "\n");
+
+        fprintf(f, "  ldflags =");
+        for(int i = 0; i < target->ldflag_count; i++)
+            fprintf(f, " %s", target->ldflags[i]);
+        for(int i = 0; i < graph->target_link_count[t]; i++) {
+            Target *lib = &cfg->targets[graph->target_links[t][i]];
+            if(lib->kind != TARGET_STATIC_LIBRARY) continue;
+            for(int j = 0; j < lib->ldflag_count; j++)
+                fprintf(f, " %s", lib->ldflags[j]);
+        }
+        if(has_shared)
+            fprintf(f, " -Wl,-rpath,'$$ORIGIN'");
+        fprintf(f, "\n\n");
+    }
+
+    /* short aliases and run edges, mirroring the Makefile's targets */
+    int executable_count = 0;
+    int last_executable = -1;
+    for(int t = 0; t < cfg->target_count; t++) {
+        Target *target = &cfg->targets[t];
+        if(strcmp(outputs[t], target->name) != 0) {
+            fprintf(f, "build %s: phony ", target->name);
+            ninja_path(f, outputs[t]);
+            fprintf(f, "\n");
+        }
+        if(target->kind != TARGET_EXECUTABLE) continue;
+        executable_count++;
+        last_executable = t;
+        fprintf(f, "build run-%s: run ", target->name);
+        ninja_path(f, outputs[t]);
+        fprintf(f, "\n");
+    }
+    if(executable_count == 1) {
+        fprintf(f, "build run: phony run-%s\n", cfg->targets[last_executable].name);
+    }
+
+    fprintf(f, "\nbuild all: phony");
+    for(int t = 0; t < cfg->target_count; t++) {
+        fprintf(f, " ");
+        ninja_path(f, outputs[t]);
+    }
+    fprintf(f, "\n\ndefault all\n");
+
+    build_graph_free(graph);
+    return 1;
+}
@@ -0,0 +1,250 @@
+#define _GNU_SOURCE
+#include "anvil.h"
+#include "colors.h"
+#include <fcntl.h>
+
+/*
+ * Content-addressed object cache shared by every checkout on the machine.
+ *
+ * Objects are keyed by the compiler identity, the compile command (which
+ * only holds build-relative paths) and a hash of the preprocessed source
+ * with the project root stripped, so the same code built from another
+ * worktree hits. Entries live in <cache>/<2 hex>/<14 hex>.o; their mtime
+ * is bumped on every hit and the oldest ones go once the cache outgrows
+ * its size cap.
+ */
+
+#define DEFAULT_CACHE_SIZE (5LL * 1024 * 1024 * 1024)
+
+int64_t parse_size(const char *value) {
+    char *end;
+    double n = strtod(value, &end);
+    if(end == value || n < 0) return -1;
+    switch(toupper((unsigned char)*end)) {
+        case 'K': n *= 1024; break;
+        case 'M': n *= 1024 * 1024; break;
+        case 'G': n *= 1024.0 * 1024 * 1024; break;
+        case 0: break;
+        default: return -1;
+    }
+    return (int64_t)n;
+}
+
+/* hash `gcc --version` and the target triple once per build */
+static uint64_t compiler_identity(void) {
+    FILE *p = popen("gcc --version 2>&1 && gcc -dumpmachine 2>&1", "r");
+    if(!p) return 0;
+
+    char buf[4096];
+    size_t len = fread(buf, 1, sizeof(buf), p);
+    pclose(p);
+    return hash_bytes(buf, len, 0x616e76696cULL);
+}
+
+int object_cache_init(ObjectCache *cache, BuildConfig *cfg) {
+    memset(cache, 0, sizeof(*cache));
+    if(!cfg->cache_enabled) return 1;
+
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    if(cfg->cache_dir[0]) {
+        snprintf(cache->dir, sizeof(cache->dir), "%s", cfg->cache_dir);
+    } else if(xdg && xdg[0]) {
+        snprintf(cache->dir, sizeof(cache->dir), "%s/anvil", xdg);
+    } else if(home && home[0]) {
+        snprintf(cache->dir, sizeof(cache->dir), "%s/.cache/anvil", home);
+    } else {
+        fprintf(stderr, "Warning: No cache directory (set cache_dir or HOME); object cache disabled\n");
+        return 0;
+    }
+
+    if(!create_directory_recursive(cache->dir)) {
+        fprintf(stderr, "Warning: Cannot create %s; object cache disabled\n", cache->dir);
+        return 0;
+    }
+    if(!getcwd(cache->root, sizeof(cache->root))) cache->root[0] = 0;
+
+    cache->max_size = cfg->cache_size > 0 ? cfg->cache_size : DEFAULT_CACHE_SIZE;
+    cache->compiler = compiler_identity();
+    cache->enabled = 1;
+    return 1;
+}
+
+/* hash a preprocessed file with every occurrence of the checkout root cut out */
+int object_cache_key(ObjectCache *cache, const char *preprocessed, const char *cmd, uint64_t *key) {
+    FILE *f = fopen(preprocessed, "rb");
+    if(!f) return 0;
+
+    size_t cap = 1 << 16, len = 0, n;
+    char *buf = malloc(cap + 1);
+    while(buf && (n = fread(buf + len, 1, cap - len, f)) > 0) {
+        len += n;
+        if(len == cap) {
+            char *grown = realloc(buf, cap * 2 + 1);
+            if(!grown) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    fclose(f);
+    if(!buf) return 0;
+
+    uint64_t h = hash_bytes(&cache->compiler, sizeof(cache->compiler), 0);
+    h = hash_bytes(cmd, strlen(cmd), h);
+
+    size_t root_len = strlen(cache->root);
+    char *p = buf, *end = buf + len;
+    char *hit;
+    while(root_len > 1 && (hit = memmem(p, end - p, cache->root, root_len)) != NULL) {
+        h = hash_bytes(p, hit - p, h);
+        p = hit + root_len;
+    }
+    h = hash_bytes(p, end - p, h);
+
+    free(buf);
+    *key = h;
+    return 1;
+}
+
+static void entry_path(ObjectCache *cache, uint64_t key, char *out, size_t size) {
+    char hex[17];
+    snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+    snprintf(out, size, "%s/%.2s/%s.o", cache->dir, hex, hex + 2);
+}
+
+/* copy through a temporary name so readers never see half a file */
+static int copy_file(const char *from, const char *to) {
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", to, (int)getpid());
+
+    int in = open(from, O_RDONLY);
+    if(in < 0) return 0;
+    int out = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out < 0) {
+        close(in);
+        return 0;
+    }
+
+    char buf[65536];
+    ssize_t n;
+    int ok = 1;
+    while((n = read(in, buf, sizeof(buf))) > 0) {
+        if(write(out, buf, n) != n) {
+            ok = 0;
+            break;
+        }
+    }
+    if(n < 0) ok = 0;
+    close(in);
+    if(close(out) != 0) ok = 0;
+
+    if(!ok || rename(tmp, to) != 0) {
+        unlink(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+int object_cache_fetch(ObjectCache *cache, uint64_t key, const char *dest) {
+    char path[600];
+    entry_path(cache, key, path, sizeof(path));
+
+    if(!copy_file(path, dest)) {
+        __sync_fetch_and_add(&cache->misses, 1);
+        return 0;
+    }
+    utimensat(AT_FDCWD, path, NULL, 0);  /* most recently used */
+    __sync_fetch_and_add(&cache->hits, 1);
+    return 1;
+}
+
+void object_cache_store(ObjectCache *cache, uint64_t key, const char *src) {
+    char path[600], dir[600];
+    entry_path(cache, key, path, sizeof(path));
+    snprintf(dir, sizeof(dir), "%s", path);
+    *strrchr(dir, '/') = 0;
+
+    if(create_directory_recursive(dir) && copy_file(src, path)) {
+        __sync_fetch_and_add(&cache->stores, 1);
+    }
+}
+
+typedef struct {
+    char path[1100];
+    time_t mtime;
+    int64_t size;
+} CacheEntry;
+
+static int by_mtime(const void *a, const void *b) {
+    const CacheEntry *x = a, *y = b;
+    return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+/* least recently used entries go first until the cache is back under 90% of its cap */
+void object_cache_trim(ObjectCache *cache) {
+    if(!cache->enabled || cache->stores == 0) return;
+
+    CacheEntry *entries = NULL;
+    int count = 0, capacity = 0;
+    int64_t total = 0;
+
+    DIR *top = opendir(cache->dir);
+    if(!top) return;
+    struct dirent *bucket;
+    while((bucket = readdir(top)) != NULL) {
+        if(bucket->d_name[0] == '.') continue;
+        char bucket_path[800];
+        snprintf(bucket_path, sizeof(bucket_path), "%s/%s", cache->dir, bucket->d_name);
+        DIR *d = opendir(bucket_path);
+        if(!d) continue;
+
+        struct dirent *entry;
+        while((entry = readdir(d)) != NULL) {
+            if(entry->d_name[0] == '.') continue;
+            if(count == capacity) {
+                int grown_capacity = capacity ? capacity * 2 : 256;
+                CacheEntry *grown = realloc(entries, grown_capacity * sizeof(CacheEntry));
+                if(!grown) break;
+                entries = grown;
+                capacity = grown_capacity;
+            }
+            CacheEntry *e = &entries[count];
+            struct stat st;
+            snprintf(e->path, sizeof(e->path), "%s/%s", bucket_path, entry->d_name);
+            if(stat(e->path, &st) != 0) continue;
+            e->mtime = st.st_mtime;
+            e->size = st.st_size;
+            total += st.st_size;
+            count++;
+        }
+        closedir(d);
+    }
+    closedir(top);
+
+    if(total > cache->max_size) {
+        qsort(entries, count, sizeof(CacheEntry), by_mtime);
+        int64_t target = cache->max_size / 10 * 9;
+        for(int i = 0; i < count && total > target; i++) {
+            if(unlink(entries[i].path) == 0) {
+                total -= entries[i].size;
+                cache->evictions++;
+            }
+        }
+    }
+    free(entries);
+}
+
+void object_cache_report(ObjectCache *cache) {
+    if(!cache->enabled) return;
+    int lookups = cache->hits + cache->misses;
+    if(lookups == 0) return;
+
+    printf(DIM "Cache: %d hit%s, %d miss%s (%d%% hit rate)", cache->hits, cache->hits == 1 ? "" : "s",
+           cache->misses, cache->misses == 1 ? "" : "es", cache->hits * 100 / lookups);
+    if(cache->evictions > 0) printf(", %d evicted", cache->evictions);
+    printf(RESET "\n");
+}
@@ -0,0 +1,143 @@
+#include "anvil.h"
+#include "colors.h"
+
+/*
+ * Profile-guided optimization pipeline for `anvil build` with
+ * optimize = pgo: an instrumented build, a training run, then the real
+ * build with -fprofile-use. The profile in <build dir>/pgo is stamped
+ * with a fingerprint of the sources, headers and flags it was trained on,
+ * and the first two stages only rerun when that fingerprint changes.
+ */
+
+/* sources, project headers, compile flags and the workload the profile depends on */
+static int profile_fingerprint(BuildConfig *cfg, uint64_t *fingerprint) {
+    WatchSet files = {0};
+    for(int t = 0; t < cfg->target_count; t++) {
+        for(int i = 0; i < cfg->targets[t].source_count; i++)
+            add_watch_file(cfg->targets[t].sources[i], &files);
+    }
+    if(cfg->pch[0]) add_watch_file(cfg->pch, &files);
+    for(int i = 0; i < cfg->include_count; i++)
+        scan_directory_for_headers(cfg->includes[i], &files);
+
+    uint64_t h = hash_bytes(cfg->train_cmd, strlen(cfg->train_cmd), 0);
+    for(int i = 0; i < files.count; i++) {
+        const char *path = watch_set_path(&files, i);
+        uint64_t file_hash;
+        if(!hash_file(path, &file_hash)) file_hash = 0;
+        h = hash_bytes(path, strlen(path), h);
+        h = hash_bytes(&file_hash, sizeof(file_hash), h);
+    }
+    watch_set_free(&files);
+
+    BuildGraph *graph = build_graph_create(cfg);
+    if(!graph) return 0;
+    for(int i = 0; i < graph->flagset_count; i++) {
+        char flags[4096];
+        compile_flags(cfg, graph, i, flags, sizeof(flags));
+        h = hash_bytes(flags, strlen(flags), h);
+    }
+    build_graph_free(graph);
+
+    *fingerprint = h;
+    return 1;
+}
+
+static void stamp_path(BuildConfig *cfg, char *out, size_t size) {
+    snprintf(out, size, "%s/pgo/.anvil_profile", cfg->build_dir);
+}
+
+static int profile_is_current(BuildConfig *cfg, uint64_t fingerprint) {
+    char stamp_file[256];
+    stamp_path(cfg, stamp_file, sizeof(stamp_file));
+    FILE *f = fopen(stamp_file, "r");
+    if(!f) return 0;
+    unsigned long long stamp = 0;
+    int ok = fscanf(f, "%llx", &stamp) == 1 && stamp == fingerprint;
+    fclose(f);
+    return ok;
+}
+
+/* run train_cmd, or every executable the way its run-<target> rule does */
+static int run_training(BuildConfig *cfg) {
+    if(cfg->train_cmd[0]) {
+        printf(DIM "$ %s" RESET "\n", cfg->train_cmd);
+        fflush(stdout);
+        if(system(cfg->train_cmd) != 0) {
+            fprintf(stderr, "Error: Training command failed: %s\n", cfg->train_cmd);
+            return 0;
+        }
+        return 1;
+    }
+
+    int trained = 0;
+    for(int t = 0; t < cfg->target_count; t++) {
+        Target *target = &cfg->targets[t];
+        if(target->kind != TARGET_EXECUTABLE) continue;
+
+        char output[256], cmd[400];
+        target_output_path(cfg, target, output, sizeof(output));
+        snprintf(cmd, sizeof(cmd), "cd %s && ./%s", cfg->build_dir, output);
+        printf(DIM "$ run-%s" RESET "\n", target->name);
+        fflush(stdout);
+        if(system(cmd) != 0) {
+            fprintf(stderr, "Error: Training run of '%s' failed (set train_cmd for a custom workload)\n", target->name);
+            return 0;
+        }
+        trained++;
+    }
+    if(!trained) {
+        fprintf(stderr, "Error: No executable to train with; set train_cmd\n");
+        return 0;
+    }
+    return 1;
+}
+
+/* objects built under one stage's flags must not be reused by the other */
+static void remove_objects(BuildConfig *cfg) {
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s/obj", cfg->build_dir);
+    system(cmd);
+}
+
+int pgo_build(BuildConfig *cfg, int jobs) {
+    uint64_t fingerprint;
+    if(!profile_fingerprint(cfg, &fingerprint)) return 0;
+
+    char pgo_dir[256], stamp_file[256];
+    snprintf(pgo_dir, sizeof(pgo_dir), "%s/pgo", cfg->build_dir);
+    stamp_path(cfg, stamp_file, sizeof(stamp_file));
+
+    if(profile_is_current(cfg, fingerprint)) {
+        printf(DIM "Using the profile in %s" RESET "\n", pgo_dir);
+        cfg->pgo_stage = PGO_USE;
+        return execute_build(cfg, jobs);
+    }
+
+    printf(BRIGHT_YELLOW "PGO 1/3:" RESET " instrumented build\n");
+    char cmd[300];
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", pgo_dir);
+    system(cmd);
+    remove_objects(cfg);
+    if(!create_directory_recursive(pgo_dir)) {
+        fprintf(stderr, "Error: Cannot create %s\n", pgo_dir);
+        return 0;
+    }
+    cfg->pgo_stage = PGO_GENERATE;
+    int ok = execute_build(cfg, jobs);
+    cfg->pgo_stage = PGO_USE;
+    if(!ok) return 0;
+
+    printf("\n" BRIGHT_YELLOW "PGO 2/3:" RESET " training\n");
+    if(!run_training(cfg)) return 0;
+
+    FILE *f = fopen(stamp_file, "w");
+    if(f) {
+        fprintf(f, "%016llx\n", (unsigned long long)fingerprint);
+        fclose(f);
+    }
+
+    printf("\n" BRIGHT_YELLOW "PGO 3/3:" RESET " optimized build\n");
+    remove_objects(cfg);
+    return execute_build(cfg, jobs);
+}
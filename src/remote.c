@@ -0,0 +1,652 @@
+#define _GNU_SOURCE
+#include "anvil.h"
+#include "colors.h"
+#include <fcntl.h>
+#include <netdb.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * Distributed compilation. `anvil build` preprocesses locally and ships
+ * the preprocessed source plus the compile flags to `anvil worker`
+ * processes, which compile it and send the object back. Workers are
+ * reached over TCP (host[:port]) or through a command transport
+ * (ssh:host runs `anvil worker --stdio` on the far side). The protocol
+ * is a greeting line and then length-prefixed request/reply frames:
+ *
+ *   worker: ANVIL-WORKER 2 <cores>\n
+ *   client: COMPILE <flags bytes> <source bytes>\n <flags> <source>
+ *   worker: RESULT <status> <output bytes> <object bytes>\n <output> <object>
+ */
+
+#define REMOTE_PROTOCOL 2
+
+static int write_full(int fd, const void *data, size_t len) {
+    const char *p = data;
+    while(len > 0) {
+        ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+        if(n < 0 && errno == ENOTSOCK) n = write(fd, p, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return 0;
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+static int read_full(int fd, void *data, size_t len) {
+    char *p = data;
+    while(len > 0) {
+        ssize_t n = read(fd, p, len);
+        if(n < 0 && errno == EINTR) continue;
+        if(n <= 0) return 0;
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+/* frame headers are short; reading them a byte at a time keeps the payload in the fd */
+static int read_line(int fd, char *line, size_t size) {
+    size_t len = 0;
+    while(len + 1 < size) {
+        char c;
+        if(!read_full(fd, &c, 1)) return 0;
+        if(c == '\n') break;
+        line[len++] = c;
+    }
+    line[len] = 0;
+    return 1;
+}
+
+static char *read_file(const char *path, size_t *size) {
+    FILE *f = fopen(path, "rb");
+    if(!f) return NULL;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    char *data = len >= 0 ? malloc(len + 1) : NULL;
+    if(data && fread(data, 1, len, f) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    if(data) {
+        data[len] = 0;
+        *size = len;
+    }
+    return data;
+}
+
+/*
+ * Split the flags a client sent into words the way sh would, honouring
+ * quotes and backslashes but expanding nothing, since no shell runs them.
+ * Returns the word count, or -1 when there are too many or a quote is open.
+ */
+static int split_flags(char *flags, char **argv, int max) {
+    int argc = 0;
+    char *p = flags;
+    while(1) {
+        while(*p == ' ' || *p == '\t' || *p == '\n') p++;
+        if(!*p) return argc;
+        if(argc >= max) return -1;
+
+        char *word = p, *out = p;
+        char quote = 0;
+        while(*p && (quote || (*p != ' ' && *p != '\t' && *p != '\n'))) {
+            if(quote == '\'') {
+                if(*p == '\'') quote = 0;
+                else *out++ = *p;
+                p++;
+            } else if(*p == '\\' && p[1] && (!quote || strchr("\"\\$`", p[1]))) {
+                *out++ = p[1];
+                p += 2;
+            } else if(*p == quote) {
+                quote = 0;
+                p++;
+            } else if(!quote && (*p == '"' || *p == '\'')) {
+                quote = *p++;
+            } else {
+                *out++ = *p++;
+            }
+        }
+        if(quote) return -1;
+        int end = *p != 0;
+        *out = 0;
+        argv[argc++] = word;
+        if(!end) return argc;
+        p++;
+    }
+}
+
+/* an option value that cannot name a file outside the job: a plain word like auto, hidden or address,undefined */
+static int plain_value(const char *value) {
+    if(!isalnum((unsigned char)*value)) return 0;
+    for(; *value; value++) {
+        if(!isalnum((unsigned char)*value) && !strchr("_+,-", *value)) return 0;
+    }
+    return 1;
+}
+
+/*
+ * Whether a worker compiles with this flag. Only options that shape code
+ * generation or diagnostics pass: -O*, -g*, -std=, -W* without a value,
+ * -m*, -D and -U, and -f* minus those that load plugins or read or write
+ * files of their own. A value after '=' must be a plain word, never a path.
+ */
+int remote_flag_allowed(const char *flag) {
+    static const char *exact[] = { "-pipe", "-w", "-ansi", "-pedantic", "-pedantic-errors", "-pthread", NULL };
+    static const char *file_options[] = {
+        "-fplugin", "-fdump", "-fopt-info", "-fprofile", "-fauto-profile", "-ftest-coverage", "-fcallgraph-info",
+        "-fstack-usage", "-fsave-optimization-record", "-fdiagnostics-format", "-fdiagnostics-add-output",
+        "-fdiagnostics-set-output", "-fself-test", NULL
+    };
+    for(int i = 0; exact[i]; i++) {
+        if(strcmp(flag, exact[i]) == 0) return 1;
+    }
+    if((strncmp(flag, "-D", 2) == 0 || strncmp(flag, "-U", 2) == 0) && flag[2]) return 1;
+
+    const char *value = strchr(flag, '=');
+    if(strncmp(flag, "-W", 2) == 0) {
+        /* -Wa, -Wl and -Wp hand options (and @files) to other programs */
+        return flag[2] && flag[3] != ',' && !value;
+    }
+    if(strncmp(flag, "-f", 2) == 0) {
+        for(int i = 0; file_options[i]; i++) {
+            if(strncmp(flag, file_options[i], strlen(file_options[i])) == 0) return 0;
+        }
+    } else if(strncmp(flag, "-O", 2) != 0 && strncmp(flag, "-g", 2) != 0 &&
+              strncmp(flag, "-m", 2) != 0 && strncmp(flag, "-std=", 5) != 0) {
+        return 0;
+    }
+    return !value || plain_value(value + 1);
+}
+
+/*
+ * The flags to send along with a preprocessed unit: include paths and
+ * forced includes were used up by the local preprocessor and are dropped,
+ * and every other word is single-quoted for the worker's splitter.
+ * Returns 0 when a flag is one the worker refuses, so the job stays local.
+ */
+int remote_flags(const char *flags, char *out, size_t size) {
+    static const char *with_argument[] = { "-isystem", "-iquote", "-idirafter", "-include", "-imacros", NULL };
+    char copy[MAX_LINE * 8];
+    char *argv[MAX_LINE];
+    snprintf(copy, sizeof(copy), "%s", flags);
+    int argc = split_flags(copy, argv, MAX_LINE);
+    if(argc < 0) return 0;
+
+    size_t len = 0;
+    out[0] = 0;
+    for(int i = 0; i < argc; i++) {
+        if(strncmp(argv[i], "-I", 2) == 0) continue;
+        int skip = 0;
+        for(int j = 0; with_argument[j]; j++) {
+            size_t n = strlen(with_argument[j]);
+            if(strncmp(argv[i], with_argument[j], n) == 0) skip = argv[i][n] ? 1 : 2;
+        }
+        if(skip) {
+            i += skip - 1;
+            continue;
+        }
+        if(!remote_flag_allowed(argv[i])) return 0;
+
+        if(len + 4 >= size) return 0;
+        out[len++] = ' ';
+        out[len++] = '\'';
+        for(const char *p = argv[i]; *p; p++) {
+            if(len + 6 >= size) return 0;
+            if(*p == '\'') {
+                memcpy(out + len, "'\\''", 4);
+                len += 4;
+            } else {
+                out[len++] = *p;
+            }
+        }
+        out[len++] = '\'';
+        out[len] = 0;
+    }
+    return 1;
+}
+
+/* run gcc in dir without a shell, its messages appended to out.txt; returns its exit status */
+static int run_gcc(const char *dir, char **argv) {
+    pid_t pid = fork();
+    if(pid < 0) return -1;
+    if(pid == 0) {
+        if(chdir(dir) != 0) _exit(127);
+        int fd = open("out.txt", O_WRONLY | O_CREAT | O_APPEND, 0644);
+        if(fd < 0) _exit(127);
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+        execvp("gcc", argv);
+        _exit(127);
+    }
+    int rc;
+    while(waitpid(pid, &rc, 0) < 0) {
+        if(errno != EINTR) return -1;
+    }
+    return WIFEXITED(rc) ? WEXITSTATUS(rc) : -1;
+}
+
+/* assembler directives that read another file, or could spell one out from pieces */
+static int reads_files(const char *assembly) {
+    static const char *directives[] = { ".incbin", ".include", ".macro", ".irp", ".altmacro", NULL };
+    for(int i = 0; directives[i]; i++) {
+        if(strcasestr(assembly, directives[i])) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Compile tu.i in dir to tu.o. The unit is compiled as preprocessed C
+ * whatever the client sent, and only to assembly first: inline asm could
+ * otherwise pull the worker's files into the object with .incbin. The
+ * assembly is checked and then assembled with the -m and -gz flags alone.
+ * Returns gcc's exit status, or REMOTE_REFUSED.
+ */
+static int run_worker_compile(const char *dir, char **flag_argv, int flag_count) {
+    char *argv[MAX_LINE + 10];
+    int argc = 0;
+    argv[argc++] = "gcc";
+    for(int i = 0; i < flag_count; i++) argv[argc++] = flag_argv[i];
+    argv[argc++] = "-S";
+    argv[argc++] = "-x";
+    argv[argc++] = "cpp-output";
+    argv[argc++] = "tu.i";
+    argv[argc++] = "-o";
+    argv[argc++] = "tu.s";
+    argv[argc] = NULL;
+    int status = run_gcc(dir, argv);
+    if(status != 0) return status;
+
+    char path[64];
+    size_t size;
+    snprintf(path, sizeof(path), "%s/tu.s", dir);
+    char *assembly = read_file(path, &size);
+    if(!assembly) return -1;
+    int refused = strlen(assembly) != size || reads_files(assembly);
+    free(assembly);
+    if(refused) {
+        unlink(path);
+        return REMOTE_REFUSED;
+    }
+
+    argc = 0;
+    argv[argc++] = "gcc";
+    for(int i = 0; i < flag_count; i++) {
+        if(strncmp(flag_argv[i], "-m", 2) == 0 || strncmp(flag_argv[i], "-gz", 3) == 0) argv[argc++] = flag_argv[i];
+    }
+    argv[argc++] = "-c";
+    argv[argc++] = "-x";
+    argv[argc++] = "assembler";
+    argv[argc++] = "tu.s";
+    argv[argc++] = "-o";
+    argv[argc++] = "tu.o";
+    argv[argc] = NULL;
+    status = run_gcc(dir, argv);
+    unlink(path);
+    return status;
+}
+
+/* the worker side of one connection: compile requests until the client hangs up */
+int remote_serve(int in, int out) {
+    char line[128];
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    snprintf(line, sizeof(line), "ANVIL-WORKER %d %ld\n", REMOTE_PROTOCOL, cores > 0 ? cores : 1);
+    if(!write_full(out, line, strlen(line))) return 0;
+
+    while(read_line(in, line, sizeof(line))) {
+        size_t flags_len, source_len;
+        if(sscanf(line, "COMPILE %zu %zu", &flags_len, &source_len) != 2 || flags_len >= MAX_LINE * 8) return 0;
+
+        char flags[MAX_LINE * 8];
+        char *source = malloc(source_len + 1);
+        if(!source || !read_full(in, flags, flags_len) || !read_full(in, source, source_len)) {
+            free(source);
+            return 0;
+        }
+        flags[flags_len] = 0;
+
+        char dir[] = "/tmp/anvil-worker-XXXXXX";
+        char path[64];
+        int status = -1;
+        char *output = NULL, *object = NULL;
+        size_t output_len = 0, object_len = 0;
+
+        /* the flags come off the network: no shell, and only flags on the allowlist */
+        char *flag_argv[MAX_LINE];
+        int flag_count = split_flags(flags, flag_argv, MAX_LINE);
+        const char *refused = flag_count < 0 ? "(unbalanced quotes or too many flags)" : NULL;
+        for(int i = 0; i < flag_count && !refused; i++) {
+            if(!remote_flag_allowed(flag_argv[i])) refused = flag_argv[i];
+        }
+        if(refused) {
+            char message[MAX_LINE];
+            snprintf(message, sizeof(message), "anvil worker: refusing compile flag %.400s\n", refused);
+            output = strdup(message);
+            output_len = output ? strlen(output) : 0;
+            status = REMOTE_REFUSED;
+        } else if(mkdtemp(dir)) {
+            snprintf(path, sizeof(path), "%s/tu.i", dir);
+            FILE *f = fopen(path, "wb");
+            if(f) {
+                fwrite(source, 1, source_len, f);
+                fclose(f);
+            }
+            status = run_worker_compile(dir, flag_argv, flag_count);
+
+            snprintf(path, sizeof(path), "%s/out.txt", dir);
+            output = read_file(path, &output_len);
+            unlink(path);
+            if(status == REMOTE_REFUSED) {
+                free(output);
+                output = strdup("anvil worker: refusing inline assembly that reads files\n");
+                output_len = output ? strlen(output) : 0;
+            }
+            snprintf(path, sizeof(path), "%s/tu.o", dir);
+            if(status == 0) object = read_file(path, &object_len);
+            unlink(path);
+            snprintf(path, sizeof(path), "%s/tu.i", dir);
+            unlink(path);
+            rmdir(dir);
+        }
+        if(status == 0 && !object) status = -1;
+        free(source);
+
+        snprintf(line, sizeof(line), "RESULT %d %zu %zu\n", status, output ? output_len : 0, object ? object_len : 0);
+        int ok = write_full(out, line, strlen(line)) &&
+                 (!output || write_full(out, output, output_len)) &&
+                 (!object || write_full(out, object, object_len));
+        free(output);
+        free(object);
+        if(!ok) return 0;
+    }
+    return 1;
+}
+
+/* read the greeting of a fresh connection */
+int remote_handshake(RemoteConn *conn, int *cores) {
+    char line[128];
+    int version;
+    if(!read_line(conn->in, line, sizeof(line)) || sscanf(line, "ANVIL-WORKER %d %d", &version, cores) != 2) return 0;
+    return version == REMOTE_PROTOCOL;
+}
+
+/*
+ * Compile a preprocessed source on the worker and store the object. Returns
+ * the compiler's exit status (with its messages in *output), -2 when the
+ * connection failed, or REMOTE_REFUSED when the worker would not take the
+ * unit's flags or inline assembly; in both cases the job runs locally.
+ */
+int remote_compile(RemoteConn *conn, const char *flags, const char *source, const char *object, char **output) {
+    *output = NULL;
+    size_t source_len;
+    char *data = read_file(source, &source_len);
+    if(!data) return -2;
+
+    char line[128];
+    snprintf(line, sizeof(line), "COMPILE %zu %zu\n", strlen(flags), source_len);
+    int sent = write_full(conn->out, line, strlen(line)) && write_full(conn->out, flags, strlen(flags)) &&
+               write_full(conn->out, data, source_len);
+    free(data);
+
+    int status;
+    size_t output_len, object_len;
+    if(!sent || !read_line(conn->in, line, sizeof(line)) ||
+       sscanf(line, "RESULT %d %zu %zu", &status, &output_len, &object_len) != 3) return -2;
+
+    char *text = malloc(output_len + 1);
+    char *bytes = malloc(object_len + 1);
+    if(!text || !bytes || !read_full(conn->in, text, output_len) || !read_full(conn->in, bytes, object_len)) {
+        free(text);
+        free(bytes);
+        return -2;
+    }
+    text[output_len] = 0;
+    *output = text;
+
+    if(status == 0) {
+        char tmp[512];
+        snprintf(tmp, sizeof(tmp), "%s.tmp", object);
+        FILE *f = fopen(tmp, "wb");
+        int ok = f && fwrite(bytes, 1, object_len, f) == object_len;
+        if(f && fclose(f) != 0) ok = 0;
+        if(!ok || rename(tmp, object) != 0) {
+            unlink(tmp);
+            status = -1;
+        }
+    }
+    free(bytes);
+    return status;
+}
+
+static void close_conn(RemoteConn *conn) {
+    if(conn->in >= 0) close(conn->in);
+    if(conn->out >= 0 && conn->out != conn->in) close(conn->out);
+    if(conn->pid > 0) {
+        kill(conn->pid, SIGTERM);
+        waitpid(conn->pid, NULL, 0);
+    }
+    conn->in = conn->out = -1;
+    conn->pid = 0;
+}
+
+static int connect_tcp(const char *spec) {
+    char host[128], port[16] = "";
+    snprintf(host, sizeof(host), "%s", spec);
+    char *colon = strrchr(host, ':');
+    if(colon) {
+        snprintf(port, sizeof(port), "%s", colon + 1);
+        *colon = 0;
+    } else {
+        snprintf(port, sizeof(port), "%d", DEFAULT_WORKER_PORT);
+    }
+
+    struct addrinfo hints = {0}, *res;
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if(getaddrinfo(host, port, &hints, &res) != 0) return -1;
+
+    int fd = -1;
+    for(struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if(fd < 0) continue;
+        /* an unreachable host should cost seconds, not the kernel's minutes-long default */
+        struct timeval timeout = { 3, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        if(connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+/* ssh:host runs the worker over $ANVIL_SSH (default ssh), talking through its stdin and stdout */
+static int connect_command(RemoteConn *conn, const char *host) {
+    int to_worker[2], from_worker[2];
+    if(pipe2(to_worker, O_CLOEXEC) != 0) return 0;
+    if(pipe2(from_worker, O_CLOEXEC) != 0) {
+        close(to_worker[0]);
+        close(to_worker[1]);
+        return 0;
+    }
+
+    const char *ssh = getenv("ANVIL_SSH");
+    char cmd[512];
+    snprintf(cmd, sizeof(cmd), "%s %s anvil worker --stdio", ssh && ssh[0] ? ssh : "ssh", host);
+
+    pid_t pid = fork();
+    if(pid == 0) {
+        dup2(to_worker[0], STDIN_FILENO);
+        dup2(from_worker[1], STDOUT_FILENO);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    close(to_worker[0]);
+    close(from_worker[1]);
+    if(pid < 0) {
+        close(to_worker[1]);
+        close(from_worker[0]);
+        return 0;
+    }
+    conn->in = from_worker[0];
+    conn->out = to_worker[1];
+    conn->pid = pid;
+    return 1;
+}
+
+/* open the slot's connection; a failure retires the slot for the rest of the build */
+int remote_connect(RemotePool *pool, int slot) {
+    RemoteConn *conn = &pool->slots[slot];
+    if(conn->in >= 0) return 1;
+    if(conn->dead) return 0;
+
+    const char *spec = pool->hosts[conn->host];
+    int cores;
+    if(strncmp(spec, "ssh:", 4) == 0) {
+        if(!connect_command(conn, spec + 4)) {
+            conn->dead = 1;
+            return 0;
+        }
+    } else {
+        int fd = connect_tcp(spec);
+        if(fd < 0) {
+            conn->dead = 1;
+            return 0;
+        }
+        conn->in = conn->out = fd;
+    }
+    if(!remote_handshake(conn, &cores)) {
+        close_conn(conn);
+        conn->dead = 1;
+        return 0;
+    }
+    conn->cores = cores;
+    return 1;
+}
+
+void remote_disconnect(RemotePool *pool, int slot) {
+    close_conn(&pool->slots[slot]);
+    pool->slots[slot].dead = 1;
+}
+
+/*
+ * Break every open connection so compiles blocked on a worker return -2 at
+ * once; sockets are shut down, command transports terminated. Only makes
+ * async-signal-safe calls, for executor_cancel.
+ */
+void remote_pool_interrupt(RemotePool *pool) {
+    for(int i = 0; i < pool->slot_count; i++) {
+        RemoteConn *conn = &pool->slots[i];
+        int fd = __atomic_load_n(&conn->in, __ATOMIC_SEQ_CST);
+        pid_t pid = __atomic_load_n(&conn->pid, __ATOMIC_SEQ_CST);
+        if(pid > 0) kill(pid, SIGTERM);
+        else if(fd >= 0) shutdown(fd, SHUT_RDWR);
+    }
+}
+
+/*
+ * Workers from a comma or space separated list of [ssh:]host[:port][/slots].
+ * Each host is contacted once up front; without /slots it gets as many
+ * slots as it reports cores. Unreachable hosts are skipped with a warning.
+ * Returns the number of remote slots.
+ */
+int remote_pool_init(RemotePool *pool, const char *list) {
+    memset(pool, 0, sizeof(*pool));
+    signal(SIGPIPE, SIG_IGN);
+
+    char list_copy[MAX_LINE];
+    snprintf(list_copy, sizeof(list_copy), "%s", list);
+    for(char *entry = strtok(list_copy, ", \t"); entry && pool->host_count < MAX_WORKER_HOSTS; entry = strtok(NULL, ", \t")) {
+        int slots = 0;
+        char *slash = strrchr(entry, '/');
+        if(slash) {
+            slots = atoi(slash + 1);
+            *slash = 0;
+        }
+
+        int host = pool->host_count++;
+        snprintf(pool->hosts[host], sizeof(pool->hosts[host]), "%s", entry);
+        if(pool->slot_count >= MAX_REMOTE_SLOTS) break;
+
+        int first = pool->slot_count++;
+        RemoteConn *conn = &pool->slots[first];
+        conn->in = conn->out = -1;
+        conn->host = host;
+        if(!remote_connect(pool, first)) {
+            fprintf(stderr, "Warning: Worker %s is unreachable, skipping it\n", entry);
+            pool->slot_count--;
+            continue;
+        }
+
+        if(slots < 1) slots = conn->cores;
+        for(int i = 1; i < slots && pool->slot_count < MAX_REMOTE_SLOTS; i++) {
+            RemoteConn *extra = &pool->slots[pool->slot_count++];
+            extra->in = extra->out = -1;
+            extra->host = host;
+        }
+    }
+    return pool->slot_count;
+}
+
+void remote_pool_free(RemotePool *pool) {
+    for(int i = 0; i < pool->slot_count; i++) close_conn(&pool->slots[i]);
+    pool->slot_count = 0;
+}
+
+/* `anvil worker [--port N] [--listen ADDR] [--stdio]` */
+int run_worker(int argc, char *argv[]) {
+    int port = DEFAULT_WORKER_PORT;
+    const char *listen_addr = "127.0.0.1";
+    for(int i = 0; i < argc; i++) {
+        if(strcmp(argv[i], "--stdio") == 0) {
+            return remote_serve(STDIN_FILENO, STDOUT_FILENO) ? 0 : 1;
+        } else if(strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if(strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            listen_addr = argv[++i];
+        }
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if(fd < 0 || inet_pton(AF_INET, listen_addr, &addr.sin_addr) != 1 ||
+       bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 64) != 0) {
+        fprintf(stderr, "Error: Cannot listen on %s:%d: %s\n", listen_addr, port, strerror(errno));
+        if(fd >= 0) close(fd);
+        return 1;
+    }
+
+    /* children are not waited for; every connection is served by its own process */
+    signal(SIGCHLD, SIG_IGN);
+    signal(SIGPIPE, SIG_IGN);
+    printf(BRIGHT_CYAN "Anvil worker listening on %s:%d" RESET "\n", listen_addr, port);
+    fflush(stdout);
+
+    while(1) {
+        int client = accept(fd, NULL, NULL);
+        if(client < 0) {
+            if(errno == EINTR) continue;
+            fprintf(stderr, "Error: accept failed: %s\n", strerror(errno));
+            close(fd);
+            return 1;
+        }
+        pid_t pid = fork();
+        if(pid == 0) {
+            close(fd);
+            signal(SIGCHLD, SIG_DFL);
+            _exit(remote_serve(client, client) ? 0 : 1);
+        }
+        close(client);
+    }
+}
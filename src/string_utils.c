@@ -27,4 +27,14 @@ void parse_list(char *value, char dest[][128], int *count, int max) {
         (*count)++;
         token = strtok(NULL, " \t");
     }
+}
+
+/* FNV-1a, 64-bit */
+uint64_t hash_string(const char *str) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    while(*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
 }
\ No newline at end of file
@@ -0,0 +1,172 @@
+#include "anvil.h"
+#include "colors.h"
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+/*
+ * Process supervisor for watch mode. With -wr every executable runs as a
+ * child in its own process group while watch mode keeps watching. A
+ * successful rebuild stops the old instance (SIGTERM to the group, then
+ * SIGKILL once run_stop_timeout_ms has passed) and starts the new one.
+ * SIGCHLD and Ctrl+C write to a pipe that the watch loop polls next to
+ * inotify, so exits of programs and of the build are seen as they happen.
+ */
+
+typedef struct {
+    char name[128];
+    pid_t pid;              /* process group leader, 0 when not running */
+} Program;
+
+static Program programs[MAX_TARGETS];
+static int wake_pipe[2] = { -1, -1 };
+static volatile sig_atomic_t interrupted = 0;
+
+static void wake(int sig) {
+    int saved = errno;
+    if(sig != SIGCHLD) interrupted = 1;
+    if(wake_pipe[1] >= 0 && write(wake_pipe[1], "", 1) < 0) {
+        /* the pipe is full; the loop is woken already */
+    }
+    errno = saved;
+}
+
+static int64_t now_ms(void) {
+    return trace_now_us() / 1000;
+}
+
+/* the fd watch mode polls for exits and Ctrl+C, -1 on failure */
+int supervisor_init(void) {
+    if(wake_pipe[0] >= 0) return wake_pipe[0];
+    if(pipe(wake_pipe) != 0) return -1;
+    for(int i = 0; i < 2; i++) {
+        fcntl(wake_pipe[i], F_SETFL, O_NONBLOCK);
+        fcntl(wake_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+
+    /* restartable, so builds running meanwhile are not disturbed; poll() still wakes */
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = wake;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    return wake_pipe[0];
+}
+
+int supervisor_interrupted(void) {
+    return interrupted;
+}
+
+static void report_exit(Program *p, int status) {
+    print_timestamp();
+    if(WIFSIGNALED(status))
+        printf(BRIGHT_CYAN "🏁 %s was terminated by signal %d" RESET "\n", p->name, WTERMSIG(status));
+    else
+        printf(BRIGHT_CYAN "🏁 %s exited with status %d" RESET "\n", p->name, WEXITSTATUS(status));
+}
+
+/* report programs that ended on their own */
+void supervisor_reap(void) {
+    char drain[64];
+    while(wake_pipe[0] >= 0 && read(wake_pipe[0], drain, sizeof(drain)) > 0);
+
+    for(int i = 0; i < MAX_TARGETS; i++) {
+        int status;
+        if(programs[i].pid <= 0 || waitpid(programs[i].pid, &status, WNOHANG) != programs[i].pid) continue;
+        report_exit(&programs[i], status);
+        programs[i].pid = 0;
+    }
+}
+
+/* graceful stop of a process group, then a kill once timeout_ms has passed; returns how long it took */
+int64_t supervisor_stop(const char *name, pid_t pid, int timeout_ms) {
+    int64_t start = now_ms();
+    int status;
+    killpg(pid, SIGTERM);
+    while(waitpid(pid, &status, WNOHANG) == 0) {
+        if(now_ms() - start >= timeout_ms) {
+            printf(DIM "%s did not stop within %d ms, killing it" RESET "\n", name, timeout_ms);
+            killpg(pid, SIGKILL);
+            while(waitpid(pid, &status, 0) < 0 && errno == EINTR);
+            break;
+        }
+        struct timespec ts = { 0, 5 * 1000000L };
+        nanosleep(&ts, NULL);
+    }
+    /* whatever the group started goes with it, so nothing keeps a port or a half-written file */
+    killpg(pid, SIGKILL);
+    return now_ms() - start;
+}
+
+static int64_t stop_program(Program *p, int timeout_ms) {
+    int64_t took = supervisor_stop(p->name, p->pid, timeout_ms);
+    p->pid = 0;
+    return took;
+}
+
+static Program *find_program(const char *name) {
+    Program *free_slot = NULL;
+    for(int i = 0; i < MAX_TARGETS; i++) {
+        if(strcmp(programs[i].name, name) == 0) return &programs[i];
+        if(!free_slot && programs[i].pid == 0) free_slot = &programs[i];
+    }
+    if(free_slot) snprintf(free_slot->name, sizeof(free_slot->name), "%s", name);
+    return free_slot;
+}
+
+/*
+ * Replace the running instance of an executable target with a fresh one.
+ * since_us (trace_now_us) is when the rebuild started, for the restart latency.
+ */
+int supervisor_restart(BuildConfig *cfg, int target, int64_t since_us) {
+    Program *p = find_program(cfg->targets[target].name);
+    if(!p) return 0;
+
+    int64_t stop_ms = -1;
+    if(p->pid > 0) stop_ms = stop_program(p, cfg->run_stop_timeout_ms);
+
+    char output[256];
+    target_output_path(cfg, &cfg->targets[target], output, sizeof(output));
+
+    /* same working directory as the run-<target> rules; the terminal's input stays with anvil */
+    pid_t pid = fork();
+    if(pid < 0) {
+        fprintf(stderr, "Error: Cannot start %s: %s\n", p->name, strerror(errno));
+        return 0;
+    }
+    if(pid == 0) {
+        setpgid(0, 0);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        int null = open("/dev/null", O_RDONLY);
+        if(null >= 0) dup2(null, STDIN_FILENO);
+        if(chdir(cfg->build_dir) != 0) _exit(127);
+        char program[260];
+        snprintf(program, sizeof(program), "%s%s", strchr(output, '/') ? "" : "./", output);
+        execl(program, program, (char *)NULL);
+        fprintf(stderr, "Error: Cannot run %s: %s\n", output, strerror(errno));
+        _exit(127);
+    }
+    setpgid(pid, pid);
+    p->pid = pid;
+
+    print_timestamp();
+    if(stop_ms >= 0) {
+        printf(BRIGHT_MAGENTA "↻ Restarted %s" RESET DIM " (pid %d) %lld ms after the rebuild started, stopping the old one took %lld ms" RESET "\n",
+               p->name, (int)pid, (long long)(now_ms() - since_us / 1000), (long long)stop_ms);
+    } else {
+        printf(BRIGHT_MAGENTA "▶ Running %s" RESET DIM " (pid %d)" RESET "\n", p->name, (int)pid);
+    }
+    return 1;
+}
+
+/* on Ctrl+C: the programs live in their own process groups and did not see it */
+void supervisor_stop_all(int timeout_ms) {
+    for(int i = 0; i < MAX_TARGETS; i++) {
+        if(programs[i].pid > 0) stop_program(&programs[i], timeout_ms);
+    }
+}
@@ -0,0 +1,173 @@
+#include "anvil.h"
+#include "colors.h"
+
+/*
+ * Build timing trace for --trace: spans for anvil's own phases and for
+ * every compile, pch and link job, written as Chrome trace events
+ * (chrome://tracing, Perfetto). Phases run on track 0; executor worker N
+ * records on track N + 1.
+ */
+
+typedef struct {
+    char name[192];
+    const char *category;
+    int track;
+    int64_t start_us;
+    int64_t dur_us;
+} TraceEvent;
+
+static struct {
+    int enabled;
+    struct timespec origin;
+    TraceEvent *events;
+    int count;
+    int capacity;
+    pthread_mutex_t lock;
+} trace = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+void trace_enable(void) {
+    trace.enabled = 1;
+    clock_gettime(CLOCK_MONOTONIC, &trace.origin);
+}
+
+int trace_enabled(void) {
+    return trace.enabled;
+}
+
+/* microseconds since tracing started */
+int64_t trace_now_us(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - trace.origin.tv_sec) * 1000000 + (now.tv_nsec - trace.origin.tv_nsec) / 1000;
+}
+
+/* record a span that started at start_us and ends now */
+void trace_span(const char *category, const char *name, int track, int64_t start_us) {
+    if(!trace.enabled) return;
+    int64_t end_us = trace_now_us();
+
+    pthread_mutex_lock(&trace.lock);
+    if(trace.count == trace.capacity) {
+        int capacity = trace.capacity ? trace.capacity * 2 : 256;
+        TraceEvent *events = realloc(trace.events, capacity * sizeof(TraceEvent));
+        if(!events) {
+            pthread_mutex_unlock(&trace.lock);
+            return;
+        }
+        trace.events = events;
+        trace.capacity = capacity;
+    }
+    TraceEvent *ev = &trace.events[trace.count++];
+    snprintf(ev->name, sizeof(ev->name), "%s", name);
+    ev->category = category;
+    ev->track = track;
+    ev->start_us = start_us;
+    ev->dur_us = end_us - start_us;
+    pthread_mutex_unlock(&trace.lock);
+}
+
+/* the number of spans so far, to report on everything recorded after it */
+int trace_mark(void) {
+    pthread_mutex_lock(&trace.lock);
+    int mark = trace.count;
+    pthread_mutex_unlock(&trace.lock);
+    return mark;
+}
+
+static void write_json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for(; *s; s++) {
+        if(*s == '"' || *s == '\\') {
+            fprintf(f, "\\%c", *s);
+        } else if((unsigned char)*s < 0x20) {
+            fprintf(f, "\\u%04x", (unsigned char)*s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/* rewrites the whole trace, so watch mode can refresh it after every build */
+int trace_write(const char *path) {
+    if(!trace.enabled) return 1;
+
+    char tmp[300];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if(!f) {
+        fprintf(stderr, "Error: Cannot create %s\n", tmp);
+        return 0;
+    }
+
+    pthread_mutex_lock(&trace.lock);
+    int tracks = 1;
+    for(int i = 0; i < trace.count; i++) {
+        if(trace.events[i].track + 1 > tracks) tracks = trace.events[i].track + 1;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"anvil\"}}");
+    for(int t = 0; t < tracks; t++) {
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", t);
+        if(t == 0) {
+            fprintf(f, "\"anvil\"}}");
+        } else {
+            fprintf(f, "\"worker %d\"}}", t);
+        }
+    }
+    for(int i = 0; i < trace.count; i++) {
+        TraceEvent *ev = &trace.events[i];
+        fprintf(f, ",\n{\"name\":");
+        write_json_string(f, ev->name);
+        fprintf(f, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lld,\"dur\":%lld}",
+                ev->category, ev->track, (long long)ev->start_us, (long long)ev->dur_us);
+    }
+    fprintf(f, "\n]}\n");
+    pthread_mutex_unlock(&trace.lock);
+
+    int ok = fclose(f) == 0;
+    if(!ok || rename(tmp, path) != 0) {
+        fprintf(stderr, "Error: Cannot write %s\n", path);
+        unlink(tmp);
+        return 0;
+    }
+    return 1;
+}
+
+static int slower_first(const void *a, const void *b) {
+    const TraceEvent *x = *(const TraceEvent * const *)a;
+    const TraceEvent *y = *(const TraceEvent * const *)b;
+    return (y->dur_us > x->dur_us) - (y->dur_us < x->dur_us);
+}
+
+/* the slowest compiles recorded since mark, cache hits left out */
+void trace_report_slowest(int mark, int count) {
+    if(!trace.enabled) return;
+
+    pthread_mutex_lock(&trace.lock);
+    TraceEvent **compiles = malloc((trace.count - mark + 1) * sizeof(TraceEvent *));
+    if(!compiles) {
+        pthread_mutex_unlock(&trace.lock);
+        return;
+    }
+    int n = 0;
+    int64_t total_us = 0;
+    for(int i = mark; i < trace.count; i++) {
+        if(strcmp(trace.events[i].category, "compile") != 0) continue;
+        compiles[n++] = &trace.events[i];
+        total_us += trace.events[i].dur_us;
+    }
+
+    if(n > 0) {
+        qsort(compiles, n, sizeof(TraceEvent *), slower_first);
+        printf("\n" BRIGHT_YELLOW "Slowest translation units" RESET DIM " (%d compiled, %.2fs total)" RESET "\n",
+               n, total_us / 1e6);
+        for(int i = 0; i < n && i < count; i++) {
+            printf("  " CYAN "%8.1f ms" RESET "  %s" DIM " (%.0f%%)" RESET "\n", compiles[i]->dur_us / 1e3,
+                   compiles[i]->name, total_us ? 100.0 * compiles[i]->dur_us / total_us : 0.0);
+        }
+    }
+    pthread_mutex_unlock(&trace.lock);
+    free(compiles);
+}
@@ -0,0 +1,127 @@
+#include "anvil.h"
+
+/*
+ * Unity (jumbo) builds: a target's C sources are grouped into generated
+ * <build dir>/unity/<target>/unity_K.c files that #include unity_batch sources
+ * each, so shared headers are parsed once per batch. Watch mode can pull
+ * an edited file out of its batch for the rest of the session.
+ */
+
+#define DEFAULT_UNITY_BATCH 8
+
+static int is_c_source(const char *path) {
+    const char *dot = strrchr(path, '.');
+    return dot && strcmp(dot, ".c") == 0;
+}
+
+int unity_excluded(BuildConfig *cfg, const char *source) {
+    for(int i = 0; i < cfg->unity_excluded_count; i++) {
+        if(strcmp(cfg->unity_excluded[i], source) == 0) return 1;
+    }
+    return 0;
+}
+
+/* returns 1 when the source sat in a batch and will now compile on its own */
+int unity_exclude(BuildConfig *cfg, const char *source) {
+    if(!cfg->unity || !is_c_source(source) || unity_excluded(cfg, source)) return 0;
+    if(cfg->unity_excluded_count >= MAX_UNITY_EXCLUDED) return 0;
+
+    int batched = 0;
+    for(int t = 0; t < cfg->target_count && !batched; t++) {
+        for(int i = 0; i < cfg->targets[t].source_count && !cfg->targets[t].no_unity; i++) {
+            if(strcmp(cfg->targets[t].sources[i], source) == 0) {
+                batched = 1;
+                break;
+            }
+        }
+    }
+    if(!batched) return 0;
+
+    snprintf(cfg->unity_excluded[cfg->unity_excluded_count++], 128, "%s", source);
+    return 1;
+}
+
+/* rewrite only when the content differs so untouched batches keep their timestamps */
+static int write_if_changed(const char *path, const char *content) {
+    size_t len = strlen(content);
+    FILE *f = fopen(path, "r");
+    if(f) {
+        char existing[MAX_SOURCES * 160];
+        size_t n = fread(existing, 1, sizeof(existing), f);
+        fclose(f);
+        if(n == len && memcmp(existing, content, len) == 0) return 1;
+    }
+
+    f = fopen(path, "w");
+    if(!f) {
+        fprintf(stderr, "Error: Cannot create %s\n", path);
+        return 0;
+    }
+    fputs(content, f);
+    fclose(f);
+    return 1;
+}
+
+/*
+ * The translation units a target compiles in unity mode. C sources are cut
+ * into batches of unity_batch in declared order; a batch file is written
+ * for every batch with two or more members left after watch-mode
+ * exclusions, so pulling a file out never reshuffles the other batches.
+ * Non-C sources, excluded files and lone leftovers compile as they are.
+ * Returns the count or -1 on error.
+ */
+int unity_sources(BuildConfig *cfg, const Target *target, char out[][128], int max) {
+    int batch_size = cfg->unity_batch > 0 ? cfg->unity_batch : DEFAULT_UNITY_BATCH;
+    char dir[128];
+    snprintf(dir, sizeof(dir), "%.56s/unity/%.40s", cfg->build_dir, target->name);
+
+    int c_sources[MAX_SOURCES];
+    int c_count = 0, count = 0;
+    for(int i = 0; i < target->source_count; i++) {
+        if(is_c_source(target->sources[i])) {
+            c_sources[c_count++] = i;
+        } else if(count < max) {
+            snprintf(out[count++], 128, "%s", target->sources[i]);
+        }
+    }
+    if(c_count > 1 && !create_directory_recursive(dir)) {
+        fprintf(stderr, "Error: Cannot create %s\n", dir);
+        return -1;
+    }
+
+    for(int start = 0, k = 1; start < c_count; start += batch_size, k++) {
+        int members[MAX_SOURCES];
+        int member_count = 0;
+        for(int i = start; i < start + batch_size && i < c_count; i++) {
+            const char *source = target->sources[c_sources[i]];
+            if(unity_excluded(cfg, source)) {
+                if(count < max) snprintf(out[count++], 128, "%s", source);
+            } else {
+                members[member_count++] = c_sources[i];
+            }
+        }
+
+        if(member_count == 1 && count < max) {
+            snprintf(out[count++], 128, "%s", target->sources[members[0]]);
+        }
+        if(member_count < 2) continue;
+
+        /* batch files sit two levels below the build directory */
+        char content[MAX_SOURCES * 160];
+        size_t len = snprintf(content, sizeof(content), "/* Generated by anvil: unity batch of %s */\n", target->name);
+        for(int m = 0; m < member_count && len < sizeof(content); m++) {
+            const char *path = target->sources[members[m]];
+            if(path[0] == '/') {
+                len += snprintf(content + len, sizeof(content) - len, "#include \"%s\"\n", path);
+            } else {
+                len += snprintf(content + len, sizeof(content) - len, "#include \"../../%s/%s\"\n", cfg->source_root, path);
+            }
+        }
+
+        char file[128];
+        snprintf(file, sizeof(file), "%.56s/unity/%.40s/unity_%d.c", cfg->build_dir, target->name, k);
+        if(!write_if_changed(file, content)) return -1;
+        if(count < max) memcpy(out[count++], file, sizeof(file));
+    }
+    return count;
+}
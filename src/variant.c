@@ -0,0 +1,71 @@
+#include "anvil.h"
+
+/*
+ * Build variants: [variant:name] blocks overlay cflags, ldflags and the
+ * optimize mode on the base config. Each variant builds in build/<name>
+ * with its own objects, build file and hash database, so switching
+ * between them never throws work away.
+ */
+
+int find_variant(BuildConfig *cfg, const char *name) {
+    for(int i = 0; i < cfg->variant_count; i++) {
+        if(strcmp(cfg->variants[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static void unknown_variant(BuildConfig *cfg, const char *name) {
+    fprintf(stderr, "Error: Unknown variant '%s' (available:", name);
+    for(int i = 0; i < cfg->variant_count; i++)
+        fprintf(stderr, " %s", cfg->variants[i].name);
+    fprintf(stderr, "%s)\n", cfg->variant_count ? "" : " none");
+}
+
+/* variant flags go after the base ones so that e.g. -O0 overrides -O2 */
+int apply_variant(BuildConfig *cfg, const char *name) {
+    int v = find_variant(cfg, name);
+    if(v < 0) {
+        unknown_variant(cfg, name);
+        return 0;
+    }
+    Variant *variant = &cfg->variants[v];
+
+    for(int i = 0; i < variant->cflag_count && cfg->cflag_count < MAX_FLAGS; i++)
+        strcpy(cfg->cflags[cfg->cflag_count++], variant->cflags[i]);
+
+    /* static libraries pass their ldflags on, so only what actually links gets them */
+    for(int t = 0; t < cfg->target_count; t++) {
+        Target *target = &cfg->targets[t];
+        if(target->kind == TARGET_STATIC_LIBRARY) continue;
+        for(int i = 0; i < variant->ldflag_count && target->ldflag_count < MAX_FLAGS; i++)
+            strcpy(target->ldflags[target->ldflag_count++], variant->ldflags[i]);
+    }
+
+    if(variant->optimize >= 0) cfg->optimize = variant->optimize;
+
+    snprintf(cfg->variant, sizeof(cfg->variant), "%s", variant->name);
+    snprintf(cfg->build_dir, sizeof(cfg->build_dir), "build/%s", variant->name);
+    strcpy(cfg->source_root, "../..");
+    return 1;
+}
+
+/* names from a comma or space separated list ("all" for every variant); -1 on an unknown name */
+int select_variants(BuildConfig *cfg, const char *list, char names[][64], int max) {
+    char list_copy[MAX_LINE];
+    snprintf(list_copy, sizeof(list_copy), "%s", list);
+
+    int count = 0;
+    for(char *name = strtok(list_copy, ", \t"); name; name = strtok(NULL, ", \t")) {
+        if(strcmp(name, "all") == 0) {
+            for(int i = 0; i < cfg->variant_count && count < max; i++)
+                snprintf(names[count++], 64, "%s", cfg->variants[i].name);
+            continue;
+        }
+        if(find_variant(cfg, name) < 0) {
+            unknown_variant(cfg, name);
+            return -1;
+        }
+        if(count < max) snprintf(names[count++], 64, "%s", name);
+    }
+    return count;
+}
@@ -0,0 +1,136 @@
+#include "anvil.h"
+
+/*
+ * The set of files watch mode follows. Paths are interned back to back in
+ * one string arena, and the stat data that is compared on every check
+ * (mtime, size, inode) sits in parallel arrays, so a full sweep touches
+ * only a few contiguous arrays. An open-addressing index maps a path to
+ * its slot, so looking up a path that inotify reported is constant time.
+ * Everything grows on demand; there is no limit on the number of files.
+ *
+ * Path pointers point into the arena and move when it grows; do not keep
+ * them across a watch_set_add.
+ */
+
+#define WATCH_SET_INITIAL 256
+
+static int grow_files(WatchSet *set) {
+    int capacity = set->capacity ? set->capacity * 2 : WATCH_SET_INITIAL;
+    size_t *path_at = realloc(set->path_at, capacity * sizeof(size_t));
+    if(!path_at) return 0;
+    set->path_at = path_at;
+    int64_t *mtimes = realloc(set->mtimes, capacity * sizeof(int64_t));
+    if(!mtimes) return 0;
+    set->mtimes = mtimes;
+    int64_t *sizes = realloc(set->sizes, capacity * sizeof(int64_t));
+    if(!sizes) return 0;
+    set->sizes = sizes;
+    ino_t *inodes = realloc(set->inodes, capacity * sizeof(ino_t));
+    if(!inodes) return 0;
+    set->inodes = inodes;
+    set->capacity = capacity;
+    return 1;
+}
+
+static int grow_arena(WatchSet *set, size_t needed) {
+    size_t size = set->arena_size ? set->arena_size : WATCH_SET_INITIAL * 32;
+    while(size < set->arena_used + needed) size *= 2;
+    if(size == set->arena_size) return 1;
+    char *arena = realloc(set->arena, size);
+    if(!arena) return 0;
+    set->arena = arena;
+    set->arena_size = size;
+    return 1;
+}
+
+/* keep the index at most half full */
+static int grow_index(WatchSet *set) {
+    int size = set->index_size ? set->index_size * 2 : WATCH_SET_INITIAL * 2;
+    int *index = calloc(size, sizeof(int));
+    if(!index) return 0;
+
+    for(int i = 0; i < set->count; i++) {
+        int slot = (int)(hash_string(watch_set_path(set, i)) & (size - 1));
+        while(index[slot]) slot = (slot + 1) & (size - 1);
+        index[slot] = i + 1;
+    }
+    free(set->index);
+    set->index = index;
+    set->index_size = size;
+    return 1;
+}
+
+const char *watch_set_path(const WatchSet *set, int i) {
+    return set->arena + set->path_at[i];
+}
+
+/* slot of a path, or -1 */
+int watch_set_find(const WatchSet *set, const char *path) {
+    if(!set->index_size) return -1;
+    int slot = (int)(hash_string(path) & (set->index_size - 1));
+    while(set->index[slot]) {
+        int i = set->index[slot] - 1;
+        if(strcmp(watch_set_path(set, i), path) == 0) return i;
+        slot = (slot + 1) & (set->index_size - 1);
+    }
+    return -1;
+}
+
+/* record what stat says about file i; 1 if that moved since last time */
+int watch_set_stat(WatchSet *set, int i) {
+    struct stat st;
+    int64_t mtime = 0, size = -1;
+    ino_t inode = 0;
+    if(stat(watch_set_path(set, i), &st) == 0) {
+        mtime = (int64_t)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+        size = st.st_size;
+        inode = st.st_ino;
+    }
+    int moved = mtime != set->mtimes[i] || size != set->sizes[i] || inode != set->inodes[i];
+    set->mtimes[i] = mtime;
+    set->sizes[i] = size;
+    set->inodes[i] = inode;
+    return moved;
+}
+
+/* add a path once; returns its slot, or -1 when out of memory */
+int watch_set_add(WatchSet *set, const char *path) {
+    int existing = watch_set_find(set, path);
+    if(existing >= 0) return existing;
+
+    size_t len = strlen(path) + 1;
+    if(set->count >= set->capacity && !grow_files(set)) return -1;
+    if(!grow_arena(set, len)) return -1;
+    if((set->count + 1) * 2 > set->index_size && !grow_index(set)) return -1;
+
+    int i = set->count++;
+    set->path_at[i] = set->arena_used;
+    memcpy(set->arena + set->arena_used, path, len);
+    set->arena_used += len;
+    set->mtimes[i] = 0;
+    set->sizes[i] = -1;
+    set->inodes[i] = 0;
+    watch_set_stat(set, i);
+
+    int slot = (int)(hash_string(path) & (set->index_size - 1));
+    while(set->index[slot]) slot = (slot + 1) & (set->index_size - 1);
+    set->index[slot] = i + 1;
+    return i;
+}
+
+/* forget every file but keep the memory for the next round */
+void watch_set_clear(WatchSet *set) {
+    set->count = 0;
+    set->arena_used = 0;
+    if(set->index) memset(set->index, 0, set->index_size * sizeof(int));
+}
+
+void watch_set_free(WatchSet *set) {
+    free(set->arena);
+    free(set->path_at);
+    free(set->mtimes);
+    free(set->sizes);
+    free(set->inodes);
+    free(set->index);
+    memset(set, 0, sizeof(*set));
+}
@@ -1,114 +1,626 @@
 #include "anvil.h"
 #include "colors.h"
+#include <signal.h>
+#include <sys/wait.h>
 
-void add_watch_file(const char *path, WatchFile *watch_files, int *watch_count) {
-    if(*watch_count >= MAX_WATCH_FILES) return;
+/* content hashes of watched files, seeded from the build's hash database */
+static HashDB content_hashes;
+static int content_hashes_loaded = 0;
 
-    strcpy(watch_files[*watch_count].path, path);
-    watch_files[*watch_count].mtime = get_mtime(path);
-    (*watch_count)++;
-}
-
-void scan_directory_for_headers(const char *dir, WatchFile *watch_files, int *watch_count) {
-    DIR *d = opendir(dir);
-    if(!d) return;
-
-    struct dirent *entry;
-    while((entry = readdir(d)) != NULL) {
-        if(entry->d_name[0] == '.') continue;
+/* what watch mode follows, and the build it is waiting for (0 when idle) */
+static WatchSet watch_set;
+static DirWatch dir_watch;
+static pid_t build_pid = 0;
 
-        char fullpath[512];  
-        int result = snprintf(fullpath, sizeof(fullpath), "%s/%s", dir, entry->d_name);
-        if(result >= (int)sizeof(fullpath)) continue;  
+void add_watch_file(const char *path, WatchSet *set) {
+    /* sources shared between targets and libraries are watched once */
+    int count = set->count;
+    if(watch_set_add(set, path) < 0) {
+        fprintf(stderr, "Warning: Out of memory, not watching %s\n", path);
+        return;
+    }
 
-        struct stat st;
-        if(stat(fullpath, &st) == 0 && S_ISDIR(st.st_mode)) {
-            scan_directory_for_headers(fullpath, watch_files, watch_count);
-        } else if(is_header_file(entry->d_name)) {
-            add_watch_file(fullpath, watch_files, watch_count);
-        }
+    if(set->count > count && content_hashes_loaded) {
+        uint64_t hash;
+        hash_db_file_hash(&content_hashes, path, &hash);
     }
+}
 
-    closedir(d);
+static int add_header(const DirEntry *entry, void *ctx) {
+    if(entry->is_dir) return 1;
+    if(is_header_file(entry->name)) add_watch_file(entry->path, ctx);
+    return 0;
 }
 
-void setup_watch_list(BuildConfig *cfg, WatchFile *watch_files, int *watch_count) {
-    *watch_count = 0;
+void scan_directory_for_headers(const char *dir, WatchSet *set) {
+    walk_directory(dir, 1, add_header, set);
+}
+
+void setup_watch_list(BuildConfig *cfg, WatchSet *set) {
+    watch_set_clear(set);
+
+    if(!content_hashes_loaded) {
+        char path[256];
+        snprintf(path, sizeof(path), "%s/.anvil_hashes", cfg->build_dir);
+        hash_db_load(&content_hashes, path);
+        content_hashes_loaded = 1;
+    }
 
-    /* watch sources from all targets (multi-target support) */
+    /* watch sources from all targets and libraries (multi-target support) */
     if(cfg->target_count > 0) {
         for(int t = 0; t < cfg->target_count; t++) {
             for(int i = 0; i < cfg->targets[t].source_count; i++) {
-                add_watch_file(cfg->targets[t].sources[i], watch_files, watch_count);
+                add_watch_file(cfg->targets[t].sources[i], set);
             }
         }
     } else {
         for(int i = 0; i < cfg->source_count; i++) {
-            add_watch_file(cfg->sources[i], watch_files, watch_count);
+            add_watch_file(cfg->sources[i], set);
         }
     }
 
+    /* precompiled headers may live outside the include directories */
+    if(cfg->pch[0]) add_watch_file(cfg->pch, set);
+    for(int t = 0; t < cfg->target_count; t++) {
+        if(cfg->targets[t].pch[0] && strcmp(cfg->targets[t].pch, "none") != 0)
+            add_watch_file(cfg->targets[t].pch, set);
+    }
+
     for(int i = 0; i < cfg->include_count; i++) {
-        scan_directory_for_headers(cfg->includes[i], watch_files, watch_count);
+        scan_directory_for_headers(cfg->includes[i], set);
     }
 
-    printf("\n" BRIGHT_CYAN "🔍 Watching " BOLD "%d" RESET BRIGHT_CYAN " files for changes..." RESET "\n", *watch_count);
+    /* edits to build.conf reload it */
+    if(cfg->config_file[0]) add_watch_file(cfg->config_file, set);
+
+    printf("\n" BRIGHT_CYAN "🔍 Watching " BOLD "%d" RESET BRIGHT_CYAN " files for changes..." RESET "\n", set->count);
 }
 
-int check_for_changes(WatchFile *watch_files, int watch_count) {
-    for(int i = 0; i < watch_count; i++) {
-        time_t current_mtime = get_mtime(watch_files[i].path);
-        if(current_mtime != watch_files[i].mtime) {
-            watch_files[i].mtime = current_mtime;
-            return 1;
-        }
+/* refresh file i's stat data; 1 if its content changed. Files inotify named are hashed even if that did not move */
+static int watch_file_changed(WatchSet *set, int i, int reported) {
+    if(!watch_set_stat(set, i) && !reported) return 0;
+
+    /* a save without edits keeps the content hash; nothing to rebuild */
+    const char *path = watch_set_path(set, i);
+    uint64_t before, after;
+    if(content_hashes_loaded &&
+       hash_db_cached_hash(&content_hashes, path, &before) &&
+       hash_db_file_hash(&content_hashes, path, &after) &&
+       before == after) {
+        return 0;
+    }
+    return 1;
+}
+
+/* index of the first file whose content changed, or -1 */
+int check_for_changes(WatchSet *set) {
+    for(int i = 0; i < set->count; i++) {
+        if(watch_file_changed(set, i, 0)) return i;
+    }
+    return -1;
+}
+
+/* what a batch of changes calls for, from least to most work */
+enum { WATCH_NOTHING, WATCH_EDITED, WATCH_FILES_MOVED, WATCH_CONFIG_CHANGED };
+
+static int in_include_dir(BuildConfig *cfg, const char *path) {
+    for(int i = 0; i < cfg->include_count; i++) {
+        size_t len = strlen(cfg->includes[i]);
+        if(strncmp(path, cfg->includes[i], len) == 0 && path[len] == '/') return 1;
     }
     return 0;
 }
 
+static void add_change(ChangeSet *changes, const char *path) {
+    for(int i = 0; i < changes->count; i++) {
+        if(strcmp(changes->paths[i], path) == 0) return;
+    }
+    if(changes->count >= MAX_CHANGED_FILES) {
+        changes->overflow = 1;
+        return;
+    }
+    strcpy(changes->paths[changes->count++], path);
+}
+
+/* one reported path, or watched file i (-1 when the path is not watched) */
+static int classify_path(BuildConfig *cfg, WatchSet *set, int i, const char *path, int reported) {
+    if(i >= 0) {
+        int was_gone = set->sizes[i] < 0;
+        int changed = watch_file_changed(set, i, reported);
+        if(set->sizes[i] < 0) return was_gone ? WATCH_NOTHING : WATCH_FILES_MOVED;
+        if(!changed) return WATCH_NOTHING;
+        if(strcmp(path, cfg->config_file) == 0) return WATCH_CONFIG_CHANGED;
+        return WATCH_EDITED;
+    }
+
+    /* a new source, header or header directory; dot names are editor scratch files */
+    struct stat st;
+    const char *slash = strrchr(path, '/');
+    const char *name = slash ? slash + 1 : path;
+    if(stat(path, &st) != 0 || name[0] == '.') return WATCH_NOTHING;
+    if(S_ISREG(st.st_mode) && (is_c_file(name) || is_header_file(name))) return WATCH_FILES_MOVED;
+    if(S_ISDIR(st.st_mode) && in_include_dir(cfg, path)) return WATCH_FILES_MOVED;
+    return WATCH_NOTHING;
+}
+
+/* the reported paths and, with all set, every watched file; what changed is added to changes */
+static int classify_changes(BuildConfig *cfg, WatchSet *set, char paths[][256], int path_count, int all, ChangeSet *changes) {
+    int level = WATCH_NOTHING;
+    for(int p = 0; p < path_count; p++) {
+        int i = watch_set_find(set, paths[p]);
+        int path_level = classify_path(cfg, set, i, paths[p], !all);
+        if(path_level != WATCH_NOTHING) add_change(changes, paths[p]);
+        if(path_level > level) level = path_level;
+    }
+    for(int i = 0; all && i < set->count; i++) {
+        const char *path = watch_set_path(set, i);
+        int path_level = classify_path(cfg, set, i, path, 0);
+        if(path_level != WATCH_NOTHING) add_change(changes, path);
+        if(path_level > level) level = path_level;
+    }
+    return level;
+}
+
+static void sleep_ms(int ms) {
+    struct timespec ts = { ms / 1000, (long)(ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+/* report programs that exited; Ctrl+C stops the build and the programs before quitting */
+static void check_children(BuildConfig *cfg) {
+    supervisor_reap();
+    if(!supervisor_interrupted()) return;
+
+    printf("\n");
+    print_timestamp();
+    printf(BRIGHT_CYAN "Stopping watch mode" RESET "\n");
+    if(build_pid > 0) supervisor_stop("The build", build_pid, cfg->run_stop_timeout_ms);
+    supervisor_stop_all(cfg->run_stop_timeout_ms);
+    exit(0);
+}
+
+/*
+ * One round of the backend: wait up to timeout_ms (-1 = until something
+ * happens; polling then checks once a second) and sort what changed into
+ * changes. Returns the WATCH_* level of the round.
+ */
+static int wait_for_changes(BuildConfig *cfg, DirWatch *w, WatchSet *set, int timeout_ms, ChangeSet *changes) {
+    static char paths[MAX_CHANGED_FILES][256];
+    int count;
+    if(w->fd >= 0) {
+        count = dir_watch_wait(w, timeout_ms, paths, MAX_CHANGED_FILES);
+        check_children(cfg);
+        if(count == 0) return WATCH_NOTHING;
+        if(count == -1) {
+            fprintf(stderr, "Warning: inotify failed, polling for changes instead\n");
+            dir_watch_close(w);
+        }
+    } else {
+        sleep_ms(timeout_ms < 0 ? 1000 : timeout_ms);
+        check_children(cfg);
+        count = dir_watch_poll(w, paths, MAX_CHANGED_FILES);
+    }
+
+    /* polling, and inotify after lost events, look at every watched file */
+    int64_t start_us = trace_now_us();
+    int level = classify_changes(cfg, set, paths, count > 0 ? count : 0, w->fd < 0 || count < 0, changes);
+    if(count == -2 && level < WATCH_FILES_MOVED) level = WATCH_FILES_MOVED;
+    if(level > changes->level) changes->level = level;
+    /* idle rounds (every second when polling) would grow the trace without end */
+    if(level != WATCH_NOTHING) trace_span("watch", "check_for_changes", 0, start_us);
+    return level;
+}
+
+typedef struct {
+    DirWatch *w;
+    int *ok;
+} TreeWatch;
+
+static int watch_subdirectory(const DirEntry *entry, void *ctx) {
+    TreeWatch *tree = ctx;
+    if(!entry->is_dir) return 0;
+    if(!dir_watch_add(tree->w, entry->path)) *tree->ok = 0;
+    return 1;
+}
+
+static void watch_tree(DirWatch *w, const char *dir, int *ok) {
+    if(!dir_watch_add(w, dir)) *ok = 0;
+    TreeWatch tree = { w, ok };
+    walk_directory(dir, 1, watch_subdirectory, &tree);
+}
+
+/* the directories of all watched files, plus whole include trees so new header directories show up */
+static int watch_directories(DirWatch *w, BuildConfig *cfg, WatchSet *set) {
+    int ok = 1;
+    char last[256] = "";
+    for(int i = 0; i < set->count; i++) {
+        char dir[256];
+        snprintf(dir, sizeof(dir), "%.255s", watch_set_path(set, i));
+        char *slash = strrchr(dir, '/');
+        if(slash) *slash = 0;
+        else strcpy(dir, ".");
+        /* files arrive directory by directory; skip the lookup for a run of siblings */
+        if(strcmp(dir, last) == 0) continue;
+        strcpy(last, dir);
+        if(!dir_watch_add(w, dir)) ok = 0;
+    }
+    for(int i = 0; i < cfg->include_count; i++)
+        watch_tree(w, cfg->includes[i], &ok);
+    return ok;
+}
+
+/* everything that decides how a target is linked */
+static void describe_link(BuildConfig *cfg, BuildGraph *graph, int t, char *out, size_t size) {
+    Target *target = &cfg->targets[t];
+    size_t len = snprintf(out, size, "%d", target->kind);
+    for(int i = 0; i < graph->target_object_count[t] && len < size; i++)
+        len += snprintf(out + len, size - len, " %s", graph->objects[graph->target_objects[t][i]].object);
+    for(int i = 0; i < target->ldflag_count && len < size; i++)
+        len += snprintf(out + len, size - len, " %s", target->ldflags[i]);
+    for(int i = 0; i < target->link_count && len < size; i++)
+        len += snprintf(out + len, size - len, " -l%s", target->links[i]);
+    if(len < size) {
+        char flags[MAX_LINE];
+        optimize_flags(cfg, flags, sizeof(flags));
+        len += snprintf(out + len, size - len, " %s", flags);
+    }
+    if(len < size) {
+        char flags[MAX_LINE];
+        link_flags(cfg, flags, sizeof(flags));
+        snprintf(out + len, size - len, " %s", flags);
+    }
+}
+
+static int remove_output(BuildConfig *cfg, const char *path) {
+    char full[512];
+    snprintf(full, sizeof(full), "%s/%s", cfg->build_dir, path);
+    return unlink(full) == 0;
+}
+
+/*
+ * Delete the objects, precompiled headers and link outputs whose command
+ * changed between two configs. make and the executor only compare
+ * timestamps, so this is what makes the next build redo exactly those.
+ */
+static int remove_changed_outputs(BuildConfig *old_cfg, BuildConfig *new_cfg) {
+    BuildGraph *old_graph = build_graph_create(old_cfg);
+    BuildGraph *new_graph = old_graph ? build_graph_create(new_cfg) : NULL;
+    if(!new_graph) {
+        build_graph_free(old_graph);
+        return 0;
+    }
+
+    int removed = 0;
+    char old_flags[4096], new_flags[4096];
+    for(int i = 0; i < new_graph->object_count; i++) {
+        BuildObject *obj = &new_graph->objects[i];
+        int same = 0;
+        for(int j = 0; j < old_graph->object_count && !same; j++) {
+            if(strcmp(old_graph->objects[j].object, obj->object) != 0) continue;
+            compile_flags(old_cfg, old_graph, old_graph->objects[j].flagset, old_flags, sizeof(old_flags));
+            compile_flags(new_cfg, new_graph, obj->flagset, new_flags, sizeof(new_flags));
+            same = strcmp(old_flags, new_flags) == 0 &&
+                   strcmp(old_graph->flagsets[old_graph->objects[j].flagset].pch, new_graph->flagsets[obj->flagset].pch) == 0;
+        }
+        char path[256];
+        snprintf(path, sizeof(path), "obj/%s", obj->object);
+        if(!same) removed += remove_output(new_cfg, path);
+    }
+
+    for(int i = 0; i < new_graph->flagset_count; i++) {
+        char pch[192];
+        pch_path(new_graph, i, pch, sizeof(pch));
+        if(!pch[0]) continue;
+        int same = 0;
+        for(int j = 0; j < old_graph->flagset_count && !same; j++) {
+            char old_pch[192];
+            pch_path(old_graph, j, old_pch, sizeof(old_pch));
+            if(strcmp(old_pch, pch) != 0) continue;
+            compile_flags(old_cfg, old_graph, j, old_flags, sizeof(old_flags));
+            compile_flags(new_cfg, new_graph, i, new_flags, sizeof(new_flags));
+            same = strcmp(old_flags, new_flags) == 0;
+        }
+        char path[256];
+        snprintf(path, sizeof(path), "obj/%s.gch", pch);
+        if(!same) removed += remove_output(new_cfg, path);
+    }
+
+    for(int t = 0; t < new_cfg->target_count; t++) {
+        int old_t = find_target(old_cfg, new_cfg->targets[t].name);
+        char output[256];
+        target_output_path(new_cfg, &new_cfg->targets[t], output, sizeof(output));
+        if(old_t >= 0) {
+            char old_output[256];
+            target_output_path(old_cfg, &old_cfg->targets[old_t], old_output, sizeof(old_output));
+            describe_link(old_cfg, old_graph, old_t, old_flags, sizeof(old_flags));
+            describe_link(new_cfg, new_graph, t, new_flags, sizeof(new_flags));
+            if(strcmp(old_output, output) == 0 && strcmp(old_flags, new_flags) == 0) continue;
+        }
+        removed += remove_output(new_cfg, output);
+    }
+
+    build_graph_free(old_graph);
+    build_graph_free(new_graph);
+    return removed;
+}
+
+/* parse build.conf again, so globs and flags are current; on errors the previous config stays */
+static int reload_config(BuildConfig *cfg) {
+    BuildConfig *fresh = malloc(sizeof(BuildConfig));
+    if(!fresh) {
+        fprintf(stderr, "Error: Out of memory\n");
+        return 0;
+    }
+    if(!parse_buildfile(cfg->config_file, fresh) || (cfg->variant[0] && !apply_variant(fresh, cfg->variant))) {
+        free(fresh);
+        print_timestamp();
+        printf(BRIGHT_RED "Keeping the previous configuration" RESET "\n");
+        return 0;
+    }
+
+    /* what this session was started with carries over */
+    fresh->cli_jobs = cfg->cli_jobs;
+    strcpy(fresh->cli_generator, cfg->cli_generator);
+    apply_command_line(fresh);
+    fresh->use_executor = cfg->use_executor;
+    memcpy(fresh->unity_excluded, cfg->unity_excluded, sizeof(cfg->unity_excluded));
+    fresh->unity_excluded_count = cfg->unity_excluded_count;
+
+    int removed = remove_changed_outputs(cfg, fresh);
+    *cfg = *fresh;
+    free(fresh);
+    if(removed) printf(DIM "%d outputs are affected by the new configuration" RESET "\n", removed);
+
+    return generate_build_files(cfg);
+}
+
 void print_timestamp(void) {
     time_t now = time(NULL);
     struct tm *t = localtime(&now);
     printf(DIM "[%02d:%02d:%02d]" RESET " ", t->tm_hour, t->tm_min, t->tm_sec);
 }
 
-int run_make(int run_after_build) {
+static const char *skip_dot_slash(const char *path) {
+    while(strncmp(path, "./", 2) == 0) path += 2;
+    return path;
+}
+
+typedef struct {
+    BuildConfig *cfg;
+    const ChangeSet *changes;
+    int hit;
+} DependencyMatch;
+
+/* depfiles name inputs relative to the build directory, changes are relative to the project root */
+static int match_dependency(const char *dep, void *ctx) {
+    DependencyMatch *match = ctx;
+    size_t root_len = strlen(match->cfg->source_root);
+    if(strncmp(dep, match->cfg->source_root, root_len) != 0 || dep[root_len] != '/') return 1;
+    dep = skip_dot_slash(dep + root_len + 1);
+
+    for(int i = 0; i < match->changes->count; i++) {
+        if(strcmp(skip_dot_slash(match->changes->paths[i]), dep) == 0) {
+            match->hit = 1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Mark the targets a change set reaches: those compiling a changed source,
+ * or an object or precompiled header whose depfile names a changed file,
+ * and then everything that links an affected library. Objects without a
+ * depfile have not been built yet and count as affected. Returns how many
+ * targets are affected, or -1 when all of them are.
+ */
+int affected_targets(BuildConfig *cfg, const ChangeSet *changes, int *affected) {
+    if(!changes || changes->overflow || changes->reloaded) return -1;
+    BuildGraph *graph = build_graph_create(cfg);
+    if(!graph) return -1;
+
+    memset(affected, 0, MAX_TARGETS * sizeof(int));
+    for(int t = 0; t < cfg->target_count; t++) {
+        Target *target = &cfg->targets[t];
+        for(int i = 0; i < target->source_count && !affected[t]; i++) {
+            for(int c = 0; c < changes->count; c++) {
+                if(strcmp(skip_dot_slash(target->sources[i]), skip_dot_slash(changes->paths[c])) == 0) affected[t] = 1;
+            }
+        }
+    }
+
+    for(int o = 0; o < graph->object_count; o++) {
+        DependencyMatch match = { cfg, changes, 0 };
+        char output[256];
+        snprintf(output, sizeof(output), "obj/%s", graph->objects[o].object);
+        if(for_each_dependency(cfg, output, match_dependency, &match) < 0) match.hit = 1;
+        if(!match.hit) continue;
+
+        for(int t = 0; t < cfg->target_count; t++) {
+            for(int i = 0; i < graph->target_object_count[t]; i++) {
+                if(graph->target_objects[t][i] == o) affected[t] = 1;
+            }
+        }
+    }
+
+    for(int f = 0; f < graph->flagset_count; f++) {
+        char pch[192], output[256];
+        pch_path(graph, f, pch, sizeof(pch));
+        if(!pch[0]) continue;
+        DependencyMatch match = { cfg, changes, 0 };
+        snprintf(output, sizeof(output), "obj/%s.gch", pch);
+        if(for_each_dependency(cfg, output, match_dependency, &match) < 0) match.hit = 1;
+        for(int c = 0; c < changes->count; c++) {
+            if(strcmp(skip_dot_slash(graph->flagsets[f].pch), skip_dot_slash(changes->paths[c])) == 0) match.hit = 1;
+        }
+        for(int t = 0; t < cfg->target_count && match.hit; t++) {
+            if(graph->target_flagset[t] == f) affected[t] = 1;
+        }
+    }
+
+    /* whoever links a rebuilt library is relinked (and rerun) too */
+    int count = 0;
+    for(int t = 0; t < cfg->target_count; t++) {
+        for(int i = 0; i < graph->target_link_count[t]; i++) {
+            if(affected[graph->target_links[t][i]]) affected[t] = 1;
+        }
+        count += affected[t];
+    }
+    build_graph_free(graph);
+    return count;
+}
+
+static void cancel_on_signal(int sig) {
+    (void)sig;
+    executor_cancel();
+}
+
+/* the build runs as its own process group, so a stale one can be stopped as a whole */
+static pid_t start_build(BuildConfig *cfg, const int *selected, const char *cmd) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid < 0) {
+        fprintf(stderr, "Error: Cannot start the build: %s\n", strerror(errno));
+        return -1;
+    }
+    if(pid == 0) {
+        setpgid(0, 0);
+        signal(SIGINT, SIG_DFL);
+        signal(SIGCHLD, SIG_DFL);
+        if(cfg->use_executor) {
+            /* make deletes the targets it was building when terminated; the executor does the same here */
+            signal(SIGTERM, cancel_on_signal);
+            int ok = execute_targets(cfg, cfg->jobs, selected);
+            trace_write(TRACE_FILE);
+            fflush(stdout);
+            _exit(ok ? 0 : 1);
+        }
+        signal(SIGTERM, SIG_DFL);
+        execl("/bin/sh", "sh", "-c", cmd, (char *)NULL);
+        _exit(127);
+    }
+    setpgid(pid, pid);
+    build_pid = pid;
+    return pid;
+}
+
+/* whether changes that came in during a build make it stale */
+static int changes_reach_build(BuildConfig *cfg, const ChangeSet *changes, const int *selected) {
+    if(changes->level >= WATCH_FILES_MOVED) return 1;
+    int affected[MAX_TARGETS];
+    int count = affected_targets(cfg, changes, affected);
+    if(count <= 0 || !selected) return count != 0;
+    for(int t = 0; t < cfg->target_count; t++) {
+        if(affected[t] && selected[t]) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Keep watching while the build runs. Changes go to pending; once they
+ * reach a target being built, the build is stopped, since its result would
+ * be out of date. Returns the build's exit status, or -1 when cancelled.
+ */
+static int wait_for_build(BuildConfig *cfg, const int *selected, ChangeSet *pending) {
+    while(1) {
+        int status;
+        pid_t done = waitpid(build_pid, &status, WNOHANG);
+        if(done == build_pid || (done < 0 && errno != EINTR)) {
+            build_pid = 0;
+            return done > 0 && WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+        }
+
+        if(wait_for_changes(cfg, &dir_watch, &watch_set, -1, pending) == WATCH_NOTHING) continue;
+        if(!changes_reach_build(cfg, pending, selected)) continue;
+
+        printf("\n");
+        print_timestamp();
+        printf(BRIGHT_CYAN "⏹  Newer changes arrived, cancelling the build" RESET "\n");
+        supervisor_stop("The build", build_pid, cfg->run_stop_timeout_ms);
+        build_pid = 0;
+        return -1;
+    }
+}
+
+static void merge_changes(ChangeSet *into, const ChangeSet *from) {
+    for(int i = 0; i < from->count; i++) add_change(into, from->paths[i]);
+    if(from->overflow) into->overflow = 1;
+    if(from->level > into->level) into->level = from->level;
+}
+
+/*
+ * Build what the changes reach (everything when changes is NULL) and, in
+ * run mode, restart the affected programs. Changes made during the build
+ * are collected in pending. Returns 0 on success, the build's exit status
+ * on failure, or -1 when the newer changes cancelled it.
+ */
+int run_make(BuildConfig *cfg, int run_after_build, const ChangeSet *changes, ChangeSet *pending) {
+    int64_t build_start_us = trace_now_us();
+
+    /* edits rebuild and rerun only the targets they reach */
+    int affected[MAX_TARGETS];
+    int scoped = affected_targets(cfg, changes, affected);
+    const int *selected = scoped >= 0 && scoped < cfg->target_count ? affected : NULL;
+
     printf("\n");
     print_timestamp();
-    printf(BRIGHT_YELLOW "Building..." RESET "\n\n");
+    if(scoped == 0) {
+        printf(DIM "No target depends on the changed files" RESET "\n");
+        return 0;
+    }
+    printf(BRIGHT_YELLOW "Building..." RESET "\n");
+    if(changes && changes->count > 1) {
+        for(int i = 0; i < changes->count && i < 5; i++) printf(DIM "  %s" RESET "\n", changes->paths[i]);
+        if(changes->overflow)
+            printf(DIM "  and more" RESET "\n");
+        else if(changes->count > 5)
+            printf(DIM "  and %d more" RESET "\n", changes->count - 5);
+    }
 
-    int result = system("cd build && make 2>&1");
+    /* names for make/ninja, which build the libraries a target links on their own */
+    char names[MAX_TARGETS * 130] = "";
+    size_t len = 0;
+    for(int t = 0; selected && t < cfg->target_count; t++) {
+        if(affected[t]) len += snprintf(names + len, sizeof(names) - len, "%s%s", len ? " " : "", cfg->targets[t].name);
+    }
+    if(selected) printf(DIM "Targets: %s" RESET "\n", names);
+    printf("\n");
+
+    /* the executor's child writes its own trace */
+    const Generator *gen = config_generator(cfg);
+    char cmd[sizeof(names) + 256] = "";
+    if(!cfg->use_executor && selected)
+        snprintf(cmd, sizeof(cmd), gen->target_command, cfg->build_dir, names);
+    else if(!cfg->use_executor)
+        snprintf(cmd, sizeof(cmd), gen->build_command, cfg->build_dir);
+    int result = start_build(cfg, selected, cmd) > 0 ? wait_for_build(cfg, selected, pending) : 1;
+    if(!cfg->use_executor) {
+        trace_span("phase", gen->name, 0, build_start_us);
+        trace_write(TRACE_FILE);
+    }
+    if(result < 0) return result;
 
     if(result == 0) {
         printf("\n");
         print_timestamp();
         printf(BRIGHT_GREEN "Build successful!" RESET "\n");
 
-        if(run_after_build) {
-            printf("\n");
-            print_timestamp();
-            printf(BRIGHT_MAGENTA "Running..." RESET "\n");
-            printf(DIM "────────────────────────────────────────" RESET "\n");
-
-            system("cd build && make run 2>&1");
-
-            printf(DIM "────────────────────────────────────────" RESET "\n");
-            print_timestamp();
-            printf(BRIGHT_CYAN "🏁 Program finished" RESET "\n");
+        /* the new build replaces each affected program; watching goes on while they run */
+        for(int t = 0; run_after_build && t < cfg->target_count; t++) {
+            if(cfg->targets[t].kind != TARGET_EXECUTABLE || (selected && !affected[t])) continue;
+            supervisor_restart(cfg, t, build_start_us);
         }
     } else {
         printf("\n");
         print_timestamp();
         printf(BRIGHT_RED "Build failed!" RESET "\n");
+        if(run_after_build) printf(DIM "The running programs are left as they are" RESET "\n");
     }
 
     return result;
 }
 
 void watch_mode(BuildConfig *cfg, int run_after_build) {
-    WatchFile watch_files[MAX_WATCH_FILES];
-    int watch_count = 0;
-
     printf("\n" BRIGHT_YELLOW "╔════════════════════════════════════════╗" RESET "\n");
     if(run_after_build) {
         printf(BRIGHT_YELLOW "║" RESET "   " RESET " " BOLD "Anvil Watch & Run Mode Active" RESET " " RESET "  "  BRIGHT_YELLOW "    ║" RESET "\n");
@@ -117,20 +629,87 @@ void watch_mode(BuildConfig *cfg, int run_after_build) {
     }
     printf(BRIGHT_YELLOW "╚════════════════════════════════════════╝" RESET "\n");
 
-    setup_watch_list(cfg, watch_files, &watch_count);
+    int64_t start_us = trace_now_us();
+    setup_watch_list(cfg, &watch_set);
+    trace_span("watch", "setup_watch_list", 0, start_us);
 
-    printf("\n" BRIGHT_BLUE "💡 Press " BOLD "Ctrl+C" RESET BRIGHT_BLUE " to stop watching" RESET "\n");
+    /* inotify unless polling was asked for; polling also covers a failed setup */
+    dir_watch_open(&dir_watch, strcmp(cfg->watch_backend, "poll") != 0);
+    if(!watch_directories(&dir_watch, cfg, &watch_set) || (dir_watch.fd < 0 && strcmp(cfg->watch_backend, "inotify") == 0))
+        fprintf(stderr, "Warning: inotify is unavailable here, polling for changes instead\n");
+    dir_watch.wake_fd = supervisor_init();
+    if(dir_watch.fd >= 0)
+        printf(DIM "Using inotify on %d directories" RESET "\n", dir_watch.dirs.count);
+    else
+        printf(DIM "Polling for changes every second" RESET "\n");
 
-    run_make(run_after_build);
+    printf("\n" BRIGHT_BLUE "💡 Press " BOLD "Ctrl+C" RESET BRIGHT_BLUE " to stop watching" RESET "\n");
 
+    /* changes made during a build are taken up as soon as it is over */
+    static ChangeSet changes, pending;
+    int result = run_make(cfg, run_after_build, NULL, &pending);
+    int full_build = result < 0;
     while(1) {
-        sleep(1);
+        if(result < 0) {
+            /* a cancelled build is redone together with what cancelled it */
+            merge_changes(&changes, &pending);
+        } else {
+            memset(&changes, 0, sizeof(changes));
+            merge_changes(&changes, &pending);
+            if(changes.level == WATCH_NOTHING) {
+                if(wait_for_changes(cfg, &dir_watch, &watch_set, -1, &changes) == WATCH_NOTHING) continue;
+            }
+        }
+        memset(&pending, 0, sizeof(pending));
 
-        if(check_for_changes(watch_files, watch_count)) {
-            printf("\n");
-            print_timestamp();
+        /*
+         * A checkout or formatter run arrives as a burst; take it whole, until
+         * the files go quiet. Only relevant changes push the deadline back;
+         * other events and supervisor wakeups just use up part of the wait.
+         */
+        int64_t quiet_us = trace_now_us() + (int64_t)cfg->watch_debounce_ms * 1000;
+        while(cfg->watch_debounce_ms > 0) {
+            int64_t left_ms = (quiet_us - trace_now_us() + 999) / 1000;
+            if(left_ms <= 0) break;
+            if(wait_for_changes(cfg, &dir_watch, &watch_set, (int)left_ms, &changes) != WATCH_NOTHING)
+                quiet_us = trace_now_us() + (int64_t)cfg->watch_debounce_ms * 1000;
+        }
+        int level = changes.level;
+        printf("\n");
+        print_timestamp();
+        if(level == WATCH_CONFIG_CHANGED) {
+            printf(BRIGHT_CYAN "⚙️  %s changed, reloading" RESET "\n", cfg->config_file);
+        } else if(level == WATCH_FILES_MOVED) {
+            printf(BRIGHT_CYAN "📁 Files added or removed" RESET "\n");
+        } else if(changes.count == 1) {
             printf(BRIGHT_CYAN "📝 File change detected!" RESET "\n");
-            run_make(run_after_build);
+        } else {
+            printf(BRIGHT_CYAN "📝 %d%s files changed" RESET "\n", changes.count, changes.overflow ? "+" : "");
+        }
+
+        if(level >= WATCH_FILES_MOVED) {
+            changes.reloaded = 1;
+            if(!reload_config(cfg)) {
+                result = 0;
+                printf("\n" BRIGHT_CYAN "🔍 Watching for changes..." RESET "\n");
+                continue;
+            }
+            setup_watch_list(cfg, &watch_set);
+            if(!watch_directories(&dir_watch, cfg, &watch_set))
+                fprintf(stderr, "Warning: inotify cannot watch every directory, polling for changes instead\n");
+        } else {
+            /* recompile edited files on their own instead of their whole unity batch */
+            int excluded = 0;
+            for(int i = 0; i < changes.count; i++) {
+                if(!unity_exclude(cfg, changes.paths[i])) continue;
+                printf(DIM "Compiling %s outside its unity batch for this session" RESET "\n", changes.paths[i]);
+                excluded = 1;
+            }
+            if(excluded) generate_build_files(cfg);
+        }
+        result = run_make(cfg, run_after_build, full_build ? NULL : &changes, &pending);
+        if(result >= 0) {
+            full_build = 0;
             printf("\n" BRIGHT_CYAN "🔍 Watching for changes..." RESET "\n");
         }
     }
@@ -0,0 +1,87 @@
+#include "../include/anvil.h"
+#include <assert.h>
+
+typedef struct {
+    char seen[16][256];
+    int count;
+} Seen;
+
+static int record(const DirEntry *entry, void *ctx) {
+    Seen *seen = ctx;
+    snprintf(seen->seen[seen->count++], sizeof(seen->seen[0]), "%s%s", entry->path, entry->is_dir ? "/" : "");
+    return strcmp(entry->name, "skipped") != 0;
+}
+
+static int stop_at_first(const DirEntry *entry, void *ctx) {
+    (void)entry;
+    (*(int *)ctx)++;
+    return -1;
+}
+
+static int was_seen(Seen *seen, const char *path) {
+    for(int i = 0; i < seen->count; i++) {
+        if(strcmp(seen->seen[i], path) == 0) return 1;
+    }
+    return 0;
+}
+
+static void touch(const char *path) {
+    FILE *f = fopen(path, "w");
+    assert(f);
+    fclose(f);
+}
+
+int main() {
+    printf("Running directory walk tests...\n");
+
+    char dir[] = "/tmp/anvil_dir_walk_XXXXXX";
+    assert(mkdtemp(dir));
+    assert(chdir(dir) == 0);
+    assert(mkdir("include", 0755) == 0);
+    assert(mkdir("include/net", 0755) == 0);
+    assert(mkdir("include/skipped", 0755) == 0);
+    touch("include/core.h");
+    touch("include/net/socket.h");
+    touch("include/skipped/hidden.h");
+    touch("include/.scratch.h");
+    assert(symlink("net", "include/link") == 0);
+
+    /* entries come with the root joined in; dot names and unvisited subtrees are left out */
+    Seen seen = {0};
+    assert(walk_directory("include", 1, record, &seen));
+    assert(was_seen(&seen, "include/core.h"));
+    assert(was_seen(&seen, "include/net/"));
+    assert(was_seen(&seen, "include/net/socket.h"));
+    assert(was_seen(&seen, "include/skipped/"));
+    assert(!was_seen(&seen, "include/skipped/hidden.h"));
+    assert(!was_seen(&seen, "include/.scratch.h"));
+    /* symlinks are followed like stat() does */
+    assert(was_seen(&seen, "include/link/"));
+    assert(was_seen(&seen, "include/link/socket.h"));
+    printf("✓ Recursive walk passed\n");
+
+    /* without recursion only the top level; "." is not prefixed */
+    memset(&seen, 0, sizeof(seen));
+    assert(walk_directory(".", 0, record, &seen));
+    assert(seen.count == 1 && strcmp(seen.seen[0], "include/") == 0);
+
+    int visited = 0;
+    assert(walk_directory("include", 1, stop_at_first, &visited));
+    assert(visited == 1);
+    assert(!walk_directory("missing", 1, record, &seen));
+    printf("✓ Walk control passed\n");
+
+    unlink("include/link");
+    unlink("include/skipped/hidden.h");
+    unlink("include/net/socket.h");
+    unlink("include/core.h");
+    unlink("include/.scratch.h");
+    rmdir("include/skipped");
+    rmdir("include/net");
+    rmdir("include");
+    assert(chdir("/") == 0);
+    rmdir(dir);
+
+    printf("✓ All directory walk tests passed!\n");
+    return 0;
+}
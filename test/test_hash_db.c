@@ -0,0 +1,59 @@
+#include "../include/anvil.h"
+#include <assert.h>
+#include <fcntl.h>
+
+static void write_file(const char *path, const char *content) {
+    FILE *f = fopen(path, "w");
+    assert(f);
+    fputs(content, f);
+    fclose(f);
+}
+
+int main() {
+    printf("Running hash database tests...\n");
+
+    /* XXH64 reference vectors */
+    assert(hash_bytes("", 0, 0) == 0xef46db3751d8e999ULL);
+    assert(hash_bytes("abc", 3, 0) == 0x44bc2cf5ad770999ULL);
+    printf("✓ Content hash tests passed\n");
+
+    char dir[] = "/tmp/anvil_hash_db_XXXXXX";
+    assert(mkdtemp(dir));
+    char file[256], db_path[256];
+    snprintf(file, sizeof(file), "%s/source.c", dir);
+    snprintf(db_path, sizeof(db_path), "%s/hashes", dir);
+
+    HashDB db;
+    uint64_t first, second, cached;
+    write_file(file, "int main(void) { return 0; }\n");
+    assert(hash_db_load(&db, db_path));
+    assert(hash_db_file_hash(&db, file, &first));
+    assert(hash_db_cached_hash(&db, file, &cached) && cached == first);
+    hash_db_set_signature(&db, file, 42);
+    assert(hash_db_signature(&db, file) == 42);
+    assert(hash_db_save(&db));
+    hash_db_free(&db);
+
+    /* entries survive a reload, and rewriting identical bytes keeps the hash */
+    assert(hash_db_load(&db, db_path));
+    assert(hash_db_signature(&db, file) == 42);
+    write_file(file, "int main(void) { return 0; }\n");
+    assert(hash_db_file_hash(&db, file, &second) && second == first);
+    assert(hash_db_signature(&db, file) == 42);
+
+    /* a real edit changes the hash and invalidates the recorded signature */
+    write_file(file, "int main(void) { return 1; }\n");
+    struct timespec later[2] = { { 0, UTIME_NOW }, { time(NULL) + 5, 0 } };
+    utimensat(AT_FDCWD, file, later, 0);
+    assert(hash_db_file_hash(&db, file, &second) && second != first);
+    assert(hash_db_signature(&db, file) == 0);
+    hash_db_free(&db);
+    printf("✓ Hash database tests passed\n");
+
+    unlink(file);
+    unlink(db_path);
+    rmdir(dir);
+
+    printf("✓ All hash database tests passed!\n");
+    return 0;
+}
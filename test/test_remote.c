@@ -0,0 +1,137 @@
+#include "../include/anvil.h"
+#include <assert.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+static void write_file(const char *path, const char *content) {
+    FILE *f = fopen(path, "w");
+    assert(f);
+    fputs(content, f);
+    fclose(f);
+}
+
+int main() {
+    printf("Running remote compile tests...\n");
+    signal(SIGPIPE, SIG_IGN);
+
+    /* a worker on the other end of a socket pair, as `anvil worker` serves each connection */
+    int sv[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if(pid == 0) {
+        close(sv[0]);
+        _exit(remote_serve(sv[1], sv[1]) ? 0 : 1);
+    }
+    close(sv[1]);
+
+    RemoteConn conn = { .in = sv[0], .out = sv[0], .host = 0 };
+    int cores = 0;
+    assert(remote_handshake(&conn, &cores));
+    assert(cores >= 1);
+    printf("✓ Handshake passed\n");
+
+    char dir[] = "/tmp/anvil_remote_XXXXXX";
+    assert(mkdtemp(dir));
+    char source[256], object[256];
+    snprintf(source, sizeof(source), "%s/unit.i", dir);
+    snprintf(object, sizeof(object), "%s/unit.o", dir);
+
+    /* a good unit comes back as an object */
+    char *output = NULL;
+    write_file(source, "int answer(void) { return 42; }\n");
+    assert(remote_compile(&conn, "-O2", source, object, &output) == 0);
+    struct stat st;
+    assert(stat(object, &st) == 0 && st.st_size > 0);
+    free(output);
+    unlink(object);
+    printf("✓ Remote compile passed\n");
+
+    /* a broken one reports the compiler's status and messages, and leaves no object */
+    write_file(source, "int broken(\n");
+    assert(remote_compile(&conn, "-O2", source, object, &output) > 0);
+    assert(output && strstr(output, "error"));
+    assert(stat(object, &st) != 0);
+    free(output);
+    printf("✓ Remote compile error passed\n");
+
+    /* flags are split like sh would, quotes and all, but never run through a shell */
+    write_file(source, "int answer(void) { return 42; }\n");
+    assert(remote_compile(&conn, "-O2 -DV=\\\"1.0\\\" '-DW=a b'", source, object, &output) == 0);
+    assert(stat(object, &st) == 0 && st.st_size > 0);
+    free(output);
+    unlink(object);
+    assert(remote_compile(&conn, "-O2 $(touch /tmp/anvil_remote_pwned)", source, object, &output) == REMOTE_REFUSED);
+    assert(stat("/tmp/anvil_remote_pwned", &st) != 0);
+    free(output);
+
+    /* only flags on the allowlist pass: nothing that loads code, reads or writes other files, or changes the language */
+    const char *refused[] = {
+        "-fplugin=/tmp/evil.so", "-specs=/tmp/evil.specs", "-B/tmp", "@/tmp/args", "-o /tmp/x", "-wrapper sh,-c",
+        "-x assembler", "-O2 -fopt-info-all=/tmp/anvil_remote_pwned", "-fprofile-note=/tmp/anvil_remote_pwned",
+        "-dumpdir /tmp/", "-dumpbase /tmp/anvil_remote_pwned", "-fdiagnostics-add-output=sarif:file=/tmp/x",
+        "-fdiagnostics-format=sarif-file", "-Wa,@/etc/hostname", "-Wl,-o,/tmp/x", "-Wp,-MD,/tmp/x",
+        "-fdebug-prefix-map=/a=/b", "-std=../../tmp/x", "-include /etc/hostname"
+    };
+    for(size_t i = 0; i < sizeof(refused) / sizeof(refused[0]); i++) {
+        assert(remote_compile(&conn, refused[i], source, object, &output) == REMOTE_REFUSED);
+        assert(output && strstr(output, "refusing"));
+        assert(stat(object, &st) != 0);
+        assert(stat("/tmp/anvil_remote_pwned", &st) != 0);
+        free(output);
+    }
+    const char *allowed[] = { "-O2", "-g -std=gnu99", "-Wall -Wextra -Wno-unused", "-march=x86-64 -mtune=generic",
+                              "-DX=1 -UX", "-fPIC -fvisibility=hidden -fno-strict-aliasing", "-pipe -pedantic" };
+    for(size_t i = 0; i < sizeof(allowed) / sizeof(allowed[0]); i++) {
+        assert(remote_compile(&conn, allowed[i], source, object, &output) == 0);
+        assert(stat(object, &st) == 0);
+        free(output);
+        unlink(object);
+    }
+
+    /* inline assembly cannot read the worker's files, even spelled out in pieces */
+    const char *reading[] = {
+        "__asm__(\".incbin \\\"/etc/hostname\\\"\");\n",
+        "__asm__(\".inc\" \"bin \\\"/etc/hostname\\\"\");\n",
+        "__asm__(\".irp d,incbin\\n.\\\\d \\\"/etc/hostname\\\"\\n.endr\");\n",
+        "__asm__(\".INCLUDE \\\"/etc/hostname\\\"\");\n"
+    };
+    for(size_t i = 0; i < sizeof(reading) / sizeof(reading[0]); i++) {
+        write_file(source, reading[i]);
+        assert(remote_compile(&conn, "-O2", source, object, &output) == REMOTE_REFUSED);
+        assert(output && strstr(output, "refusing"));
+        assert(stat(object, &st) != 0);
+        free(output);
+    }
+    write_file(source, "int answer(void) { __asm__(\"nop\"); return 42; }\n");
+    assert(remote_compile(&conn, "-O2 -m64", source, object, &output) == 0);
+    assert(stat(object, &st) == 0 && st.st_size > 0);
+    free(output);
+    unlink(object);
+
+    /* the client drops what the local preprocessor used up, quotes the rest, and keeps refused flags local */
+    char sent[512];
+    assert(remote_flags("-DVERSION=\\\"1.0\\\" -Wall -I../include -isystem /opt/inc -include ../pch.h -O2", sent, sizeof(sent)));
+    assert(strcmp(sent, " '-DVERSION=\"1.0\"' '-Wall' '-O2'") == 0);
+    assert(remote_compile(&conn, sent, source, object, &output) == 0);
+    free(output);
+    unlink(object);
+    assert(remote_flags("-D'it''s' -O2", sent, sizeof(sent)));
+    assert(remote_compile(&conn, sent, source, object, &output) == 0);
+    free(output);
+    unlink(object);
+    assert(!remote_flags("-O2 -fopt-info-all=/tmp/x", sent, sizeof(sent)));
+    printf("✓ Worker flag checks passed\n");
+
+    /* hanging up ends the worker cleanly */
+    close(sv[0]);
+    int status;
+    assert(waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    unlink(source);
+    rmdir(dir);
+
+    printf("✓ All remote compile tests passed!\n");
+    return 0;
+}
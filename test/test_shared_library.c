@@ -0,0 +1,80 @@
+#include "../include/anvil.h"
+#include <assert.h>
+#include <sys/wait.h>
+
+/*
+ * Builds a project with a shared library through every backend and runs
+ * the executable from the project root, outside build/. That only works
+ * when the library carries a soname, so the executable records a bare
+ * file name that its $ORIGIN rpath resolves.
+ */
+
+static void write_file(const char *path, const char *content) {
+    FILE *f = fopen(path, "w");
+    assert(f);
+    fputs(content, f);
+    fclose(f);
+}
+
+static int run(const char *cmd) {
+    int status = system(cmd);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static void check_executable(void) {
+    assert(run("./build/bin/app") == 42);
+    assert(run("readelf -d build/bin/app | grep NEEDED | grep -q '\\[libshapes.so\\]'") == 0);
+}
+
+int main(int argc, char *argv[]) {
+    printf("Running shared library tests...\n");
+    const char *anvil = argc > 1 ? argv[1] : "anvil";
+    char cmd[1024];
+
+    char dir[] = "/tmp/anvil_shared_XXXXXX";
+    assert(mkdtemp(dir));
+    assert(chdir(dir) == 0);
+    assert(mkdir("src", 0755) == 0);
+    write_file("src/shapes.c", "int area(int w, int h) { return w * h; }\n");
+    write_file("src/main.c", "int area(int w, int h);\nint main(void) { return area(6, 7); }\n");
+    write_file("build.conf",
+               "project = shared\n"
+               "output_dir = bin\n"
+               "[library:shapes]\n"
+               "type = shared\n"
+               "sources = src/shapes.c\n"
+               "[/library]\n"
+               "[target:app]\n"
+               "sources = src/main.c\n"
+               "links = shapes\n"
+               "[/target]\n");
+
+    /* the generated Makefile */
+    snprintf(cmd, sizeof(cmd), "%s build.conf > /dev/null && make -s -C build > /dev/null", anvil);
+    assert(run(cmd) == 0);
+    check_executable();
+    printf("✓ Makefile backend passed\n");
+
+    /* the built-in executor */
+    assert(run("rm -rf build") == 0);
+    snprintf(cmd, sizeof(cmd), "%s build build.conf > /dev/null", anvil);
+    assert(run(cmd) == 0);
+    check_executable();
+    printf("✓ Executor backend passed\n");
+
+    /* ninja, where it is installed */
+    if(run("command -v ninja > /dev/null") == 0) {
+        assert(run("rm -rf build") == 0);
+        snprintf(cmd, sizeof(cmd), "%s -G ninja build.conf > /dev/null && ninja -C build > /dev/null", anvil);
+        assert(run(cmd) == 0);
+        check_executable();
+        printf("✓ Ninja backend passed\n");
+    }
+
+    assert(chdir("/tmp") == 0);
+    snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+    run(cmd);
+
+    printf("✓ All shared library tests passed!\n");
+    return 0;
+}
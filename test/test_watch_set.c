@@ -0,0 +1,63 @@
+#include "../include/anvil.h"
+#include <assert.h>
+#include <fcntl.h>
+
+static void write_file(const char *path, const char *content) {
+    FILE *f = fopen(path, "w");
+    assert(f);
+    fputs(content, f);
+    fclose(f);
+}
+
+int main() {
+    printf("Running watch set tests...\n");
+
+    /* many more files than the old fixed table held, with stable slots across growth */
+    WatchSet set = {0};
+    char path[64];
+    for(int i = 0; i < 20000; i++) {
+        snprintf(path, sizeof(path), "src/module_%d/file_%d.c", i % 97, i);
+        assert(watch_set_add(&set, path) == i);
+    }
+    assert(set.count == 20000);
+    for(int i = 0; i < 20000; i += 7) {
+        snprintf(path, sizeof(path), "src/module_%d/file_%d.c", i % 97, i);
+        assert(watch_set_find(&set, path) == i);
+        assert(strcmp(watch_set_path(&set, i), path) == 0);
+    }
+    assert(watch_set_add(&set, "src/module_0/file_0.c") == 0);
+    assert(set.count == 20000);
+    assert(watch_set_find(&set, "src/module_0/missing.c") == -1);
+    printf("✓ Lookup tests passed\n");
+
+    /* a cleared set forgets its files but can be refilled */
+    watch_set_clear(&set);
+    assert(set.count == 0);
+    assert(watch_set_find(&set, "src/module_0/file_0.c") == -1);
+
+    char dir[] = "/tmp/anvil_watch_set_XXXXXX";
+    assert(mkdtemp(dir));
+    char file[256];
+    snprintf(file, sizeof(file), "%s/source.c", dir);
+    write_file(file, "int x;\n");
+    int i = watch_set_add(&set, file);
+    assert(i == 0 && set.sizes[i] == 7);
+    assert(!watch_set_stat(&set, i));
+
+    /* a rewrite within the same second still moves size or nanoseconds */
+    write_file(file, "int x = 1;\n");
+    assert(watch_set_stat(&set, i));
+    assert(!watch_set_stat(&set, i));
+
+    /* a removed file reads as gone */
+    unlink(file);
+    assert(watch_set_stat(&set, i));
+    assert(set.sizes[i] == -1);
+    printf("✓ Stat tests passed\n");
+
+    watch_set_free(&set);
+    rmdir(dir);
+
+    printf("✓ All watch set tests passed!\n");
+    return 0;
+}